@@ -0,0 +1,449 @@
+/*
+ * mp4microbench: isolated timing of mp4v2 property/table hot paths.
+ *
+ * A video track is created through the public API, then its stts/stsc
+ * tables are filled directly with `-n` entries, so each case measures
+ * only the routine under test.  Table serialization goes through
+ * MP4File::EnableMemoryBuffer(), so no file I/O is involved either.
+ *
+ * Every case runs `-r` times; min and median of ns/op are reported.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <getopt.h>
+#include <unistd.h>
+#include "impl.h"
+
+using mp4v2::impl::MP4File;
+using mp4v2::impl::MP4Track;
+using mp4v2::impl::MP4Property;
+using mp4v2::impl::MP4TableProperty;
+using mp4v2::impl::MP4IntegerProperty;
+using mp4v2::impl::MP4Integer32Property;
+using mp4v2::impl::MP4Integer32Array;
+using mp4v2::impl::MP4ChunkId;
+
+typedef std::chrono::steady_clock bench_clock;
+
+/*
+ * Reveals protected members of MP4Track via casting, the same way
+ * MP4TrackX does in mp4fpsmod.  Cannot have data members!
+ */
+class BenchTrack: public MP4Track {
+public:
+    MP4Integer32Property *SttsCount() { return m_pSttsCountProperty; }
+    MP4Integer32Property *SttsSampleCount()
+    {
+        return m_pSttsSampleCountProperty;
+    }
+    MP4Integer32Property *SttsSampleDelta()
+    {
+        return m_pSttsSampleDeltaProperty;
+    }
+    MP4Integer32Property *StscCount() { return m_pStscCountProperty; }
+    MP4Integer32Property *StscFirstChunk()
+    {
+        return m_pStscFirstChunkProperty;
+    }
+    MP4Integer32Property *StscSamplesPerChunk()
+    {
+        return m_pStscSamplesPerChunkProperty;
+    }
+    MP4Integer32Property *StscSampleDescrIndex()
+    {
+        return m_pStscSampleDescrIndexProperty;
+    }
+    MP4Integer32Property *StscFirstSample()
+    {
+        return m_pStscFirstSampleProperty;
+    }
+    uint32_t GetChunkStscIndexX(MP4ChunkId chunkId)
+    {
+        return GetChunkStscIndex(chunkId);
+    }
+    void ResetSttsCache() { m_cachedSttsSid = MP4_INVALID_SAMPLE_ID; }
+};
+
+struct MicroOption {
+    uint32_t entries;
+    uint32_t queries;
+    int runs;
+    std::string only;
+
+    MicroOption(): entries(2000000), queries(200), runs(5) {}
+};
+
+class Case {
+public:
+    virtual ~Case() {}
+    virtual const char *name() const = 0;
+    /* runs once, returns the number of operations performed */
+    virtual uint64_t once() = 0;
+};
+
+struct Fixture {
+    MP4FileHandle handle;
+    MP4File *file;
+    BenchTrack *track;
+    MP4TableProperty *stts;
+    std::vector<uint32_t> randomSamples;
+    std::vector<uint64_t> randomTimes;
+    std::vector<uint32_t> randomChunks;
+    uint64_t duration;
+    uint32_t chunks;
+};
+
+/* count properties are read-only; adjust them the way mp4fpsmod does */
+void setCount(MP4Integer32Property *count, uint32_t n)
+{
+    count->IncrementValue(static_cast<int32_t>(n - count->GetValue()));
+}
+
+/* deterministic, so that runs are comparable across builds */
+uint32_t lcg(uint32_t &state)
+{
+    state = state * 1664525u + 1013904223u;
+    return state >> 8;
+}
+
+void populate(Fixture &fx, const MicroOption &opt)
+{
+    BenchTrack *t = fx.track;
+    uint32_t n = opt.entries;
+
+    /* alternating deltas defeat run-length merging: one entry per sample */
+    t->SttsSampleCount()->SetCount(n);
+    t->SttsSampleDelta()->SetCount(n);
+    fx.duration = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t delta = 1001 + (i & 1);
+        t->SttsSampleCount()->SetValue(1, i);
+        t->SttsSampleDelta()->SetValue(delta, i);
+        fx.duration += delta;
+    }
+    setCount(t->SttsCount(), n);
+
+    /* chunks of 2 and 3 samples alternate: one stsc entry per chunk */
+    uint32_t nstsc = n / 2 - n / 10;
+    t->StscFirstChunk()->SetCount(nstsc);
+    t->StscSamplesPerChunk()->SetCount(nstsc);
+    t->StscSampleDescrIndex()->SetCount(nstsc);
+    t->StscFirstSample()->SetCount(nstsc);
+    uint32_t sample = 1;
+    for (uint32_t i = 0; i < nstsc; ++i) {
+        uint32_t spc = 2 + (i & 1);
+        t->StscFirstChunk()->SetValue(i + 1, i);
+        t->StscSamplesPerChunk()->SetValue(spc, i);
+        t->StscSampleDescrIndex()->SetValue(1, i);
+        t->StscFirstSample()->SetValue(sample, i);
+        sample += spc;
+    }
+    setCount(t->StscCount(), nstsc);
+    fx.chunks = nstsc;
+
+    uint32_t seed = 12345;
+    for (uint32_t i = 0; i < opt.queries; ++i) {
+        fx.randomSamples.push_back(1 + lcg(seed) % n);
+        fx.randomTimes.push_back(lcg(seed) % fx.duration);
+        fx.randomChunks.push_back(1 + lcg(seed) % nstsc);
+    }
+}
+
+void depopulate(Fixture &fx)
+{
+    BenchTrack *t = fx.track;
+    t->SttsSampleCount()->SetCount(0);
+    t->SttsSampleDelta()->SetCount(0);
+    setCount(t->SttsCount(), 0);
+    t->StscFirstChunk()->SetCount(0);
+    t->StscSamplesPerChunk()->SetCount(0);
+    t->StscSampleDescrIndex()->SetCount(0);
+    t->StscFirstSample()->SetCount(0);
+    setCount(t->StscCount(), 0);
+}
+
+class ArrayAddCase: public Case {
+    uint32_t m_n;
+public:
+    ArrayAddCase(uint32_t n): m_n(n) {}
+    const char *name() const { return "array-add"; }
+    uint64_t once()
+    {
+        MP4Integer32Array a;
+        for (uint32_t i = 0; i < m_n; ++i)
+            a.Add(i);
+        return m_n;
+    }
+};
+
+class ArrayInsertCase: public Case {
+    uint32_t m_n, m_k;
+public:
+    ArrayInsertCase(uint32_t n, uint32_t k): m_n(n), m_k(k) {}
+    const char *name() const { return "array-insert"; }
+    uint64_t once()
+    {
+        MP4Integer32Array a;
+        a.Resize(m_n);
+        for (uint32_t i = 0; i < m_k; ++i)
+            a.Insert(i, a.Size() / 2);
+        return m_k;
+    }
+};
+
+class GetValueCase: public Case {
+    Fixture &m_fx;
+    volatile uint64_t m_sink;
+public:
+    GetValueCase(Fixture &fx): m_fx(fx), m_sink(0) {}
+    const char *name() const { return "int-getvalue"; }
+    uint64_t once()
+    {
+        MP4IntegerProperty *p = m_fx.track->SttsSampleDelta();
+        uint32_t n = p->GetCount();
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < n; ++i)
+            sum += p->GetValue(i);
+        m_sink = sum;
+        return n;
+    }
+};
+
+class IncrementCase: public Case {
+    Fixture &m_fx;
+public:
+    IncrementCase(Fixture &fx): m_fx(fx) {}
+    const char *name() const { return "int-increment"; }
+    uint64_t once()
+    {
+        MP4IntegerProperty *p = m_fx.track->SttsSampleCount();
+        uint32_t n = p->GetCount();
+        for (uint32_t i = 0; i < n; ++i)
+            p->IncrementValue(1, i);
+        for (uint32_t i = 0; i < n; ++i)
+            p->IncrementValue(-1, i);
+        return 2 * static_cast<uint64_t>(n);
+    }
+};
+
+class TableWriteCase: public Case {
+    Fixture &m_fx;
+public:
+    TableWriteCase(Fixture &fx): m_fx(fx) {}
+    const char *name() const { return "table-write"; }
+    uint64_t once()
+    {
+        uint8_t *bytes;
+        uint64_t size;
+        m_fx.file->EnableMemoryBuffer(0, 8 * m_fx.stts->GetCount() + 64);
+        m_fx.stts->Write(*m_fx.file);
+        m_fx.file->DisableMemoryBuffer(&bytes, &size);
+        MP4Free(bytes);
+        return m_fx.stts->GetCount();
+    }
+};
+
+class TableReadCase: public Case {
+    Fixture &m_fx;
+    std::vector<uint8_t> m_image;
+public:
+    TableReadCase(Fixture &fx): m_fx(fx)
+    {
+        uint8_t *bytes;
+        uint64_t size;
+        m_fx.file->EnableMemoryBuffer();
+        m_fx.stts->Write(*m_fx.file);
+        m_fx.file->DisableMemoryBuffer(&bytes, &size);
+        m_image.assign(bytes, bytes + size);
+        MP4Free(bytes);
+    }
+    const char *name() const { return "table-read"; }
+    uint64_t once()
+    {
+        m_fx.file->EnableMemoryBuffer(&m_image[0], m_image.size());
+        m_fx.stts->Read(*m_fx.file);
+        m_fx.file->DisableMemoryBuffer();
+        return m_fx.stts->GetCount();
+    }
+};
+
+class SampleTimesSeqCase: public Case {
+    Fixture &m_fx;
+public:
+    SampleTimesSeqCase(Fixture &fx): m_fx(fx) {}
+    const char *name() const { return "times-seq"; }
+    uint64_t once()
+    {
+        uint32_t n = m_fx.track->SttsCount()->GetValue();
+        MP4Timestamp t;
+        m_fx.track->ResetSttsCache();
+        for (uint32_t i = 1; i <= n; ++i)
+            m_fx.track->GetSampleTimes(i, &t, 0);
+        return n;
+    }
+};
+
+class SampleTimesRandomCase: public Case {
+    Fixture &m_fx;
+public:
+    SampleTimesRandomCase(Fixture &fx): m_fx(fx) {}
+    const char *name() const { return "times-rand"; }
+    uint64_t once()
+    {
+        MP4Timestamp t;
+        for (size_t i = 0; i < m_fx.randomSamples.size(); ++i)
+            m_fx.track->GetSampleTimes(m_fx.randomSamples[i], &t, 0);
+        return m_fx.randomSamples.size();
+    }
+};
+
+class SampleFromTimeCase: public Case {
+    Fixture &m_fx;
+public:
+    SampleFromTimeCase(Fixture &fx): m_fx(fx) {}
+    const char *name() const { return "id-from-time"; }
+    uint64_t once()
+    {
+        for (size_t i = 0; i < m_fx.randomTimes.size(); ++i)
+            m_fx.track->GetSampleIdFromTime(m_fx.randomTimes[i], false);
+        return m_fx.randomTimes.size();
+    }
+};
+
+class StscIndexCase: public Case {
+    Fixture &m_fx;
+public:
+    StscIndexCase(Fixture &fx): m_fx(fx) {}
+    const char *name() const { return "stsc-index"; }
+    uint64_t once()
+    {
+        for (size_t i = 0; i < m_fx.randomChunks.size(); ++i)
+            m_fx.track->GetChunkStscIndexX(m_fx.randomChunks[i]);
+        return m_fx.randomChunks.size();
+    }
+};
+
+bool selected(const MicroOption &opt, const char *name)
+{
+    if (opt.only.empty())
+        return true;
+    std::string list = "," + opt.only + ",";
+    return list.find(std::string(",") + name + ",") != std::string::npos;
+}
+
+void measure(Case *c, const MicroOption &opt)
+{
+    std::vector<double> nsPerOp;
+    double total = 0;
+    for (int i = 0; i < opt.runs; ++i) {
+        bench_clock::time_point t0 = bench_clock::now();
+        uint64_t ops = c->once();
+        double ns = std::chrono::duration<double, std::nano>(
+                bench_clock::now() - t0).count();
+        total += ns;
+        nsPerOp.push_back(ops ? ns / ops : 0);
+    }
+    std::sort(nsPerOp.begin(), nsPerOp.end());
+    std::printf("%-14s %12.2f %12.2f %10.1f\n", c->name(), nsPerOp[0],
+                nsPerOp[nsPerOp.size() / 2], total / opt.runs / 1e6);
+    std::fflush(stdout);
+}
+
+void usage()
+{
+    std::fprintf(stderr,
+"usage: mp4microbench [options]\n"
+"  -n <entries>     Table size (default 2000000)\n"
+"  -q <queries>     Random lookups for the O(n) cases (default 200)\n"
+"  -r <runs>        Runs per case (default 5)\n"
+"  -s <list>        Comma separated cases to run (default all)\n");
+    std::exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    MicroOption opt;
+    int ch;
+    while ((ch = getopt(argc, argv, "n:q:r:s:")) != EOF) {
+        if (ch == 'n')
+            opt.entries = std::max(16, std::atoi(optarg));
+        else if (ch == 'q')
+            opt.queries = std::max(1, std::atoi(optarg));
+        else if (ch == 'r')
+            opt.runs = std::max(1, std::atoi(optarg));
+        else if (ch == 's')
+            opt.only = optarg;
+        else
+            usage();
+    }
+
+    MP4LogSetLevel(MP4_LOG_NONE);
+
+    const char *tmp = std::getenv("TMPDIR");
+    std::string path = std::string(tmp ? tmp : "/tmp") + "/mp4microbench.XXXXXX";
+    std::vector<char> buf(path.begin(), path.end());
+    buf.push_back(0);
+    int fd = mkstemp(&buf[0]);
+    if (fd < 0) {
+        std::perror("mkstemp");
+        return 2;
+    }
+    close(fd);
+    path = &buf[0];
+
+    Fixture fx;
+    fx.handle = MP4Create(path.c_str());
+    if (fx.handle == MP4_INVALID_FILE_HANDLE) {
+        std::fprintf(stderr, "can't create %s\n", path.c_str());
+        return 2;
+    }
+    fx.file = static_cast<MP4File *>(fx.handle);
+    MP4TrackId id = MP4AddH264VideoTrack(fx.handle, 90000, 3003,
+                                         1280, 720, 0x64, 0x00, 0x1f, 3);
+    std::vector<Case *> cases;
+    try {
+        fx.track = reinterpret_cast<BenchTrack *>(fx.file->GetTrack(id));
+        MP4Property *p;
+        if (!fx.track->GetTrakAtom().FindProperty(
+                    "trak.mdia.minf.stbl.stts.entries", &p))
+            throw new mp4v2::impl::Exception("stts not found",
+                                             __FILE__, __LINE__, __FUNCTION__);
+        fx.stts = static_cast<MP4TableProperty *>(p);
+        populate(fx, opt);
+
+        std::printf("entries: %u, queries: %u, runs: %d\n\n",
+                    opt.entries, opt.queries, opt.runs);
+        std::printf("%-14s %12s %12s %10s\n",
+                    "case", "min ns/op", "median ns/op", "mean ms");
+
+        cases.push_back(new ArrayAddCase(opt.entries));
+        cases.push_back(new ArrayInsertCase(opt.entries, opt.queries));
+        cases.push_back(new GetValueCase(fx));
+        cases.push_back(new IncrementCase(fx));
+        cases.push_back(new TableWriteCase(fx));
+        cases.push_back(new TableReadCase(fx));
+        cases.push_back(new SampleTimesSeqCase(fx));
+        cases.push_back(new SampleTimesRandomCase(fx));
+        cases.push_back(new SampleFromTimeCase(fx));
+        cases.push_back(new StscIndexCase(fx));
+        for (size_t i = 0; i < cases.size(); ++i)
+            if (selected(opt, cases[i]->name()))
+                measure(cases[i], opt);
+    } catch (mp4v2::impl::Exception *e) {
+        std::fprintf(stderr, "%s\n", e->msg().c_str());
+        delete e;
+        return 2;
+    }
+    for (size_t i = 0; i < cases.size(); ++i)
+        delete cases[i];
+
+    depopulate(fx);
+    MP4Close(fx.handle);
+    unlink(path.c_str());
+    return 0;
+}
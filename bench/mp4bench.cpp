@@ -0,0 +1,294 @@
+/*
+ * mp4bench: end-to-end timing of mp4fpsmod on synthetic input.
+ *
+ * A fixture is produced with mp4gen (arguments after "--" are passed to
+ * it), then each scenario is run `warmup` times untimed and `runs` times
+ * timed.  Parsing is timed in-process through MP4Read(); everything else
+ * runs the mp4fpsmod binary as a child process, so the numbers include
+ * process startup the same way a user would see it.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <mp4v2/mp4v2.h>
+
+typedef std::chrono::steady_clock bench_clock;
+
+struct BenchOption {
+    int runs;
+    int warmup;
+    std::string mp4fpsmod;
+    std::string mp4gen;
+    std::string workdir;
+    std::string only;
+    bool keep;
+    std::vector<std::string> genArgs;
+
+    BenchOption()
+        : runs(10), warmup(2), mp4fpsmod("./mp4fpsmod"),
+          mp4gen("./mp4gen"), keep(false) {}
+};
+
+struct Stats {
+    double min, median, mean, stddev;
+};
+
+Stats summarize(std::vector<double> v)
+{
+    Stats s = { 0, 0, 0, 0 };
+    if (v.empty())
+        return s;
+    std::sort(v.begin(), v.end());
+    s.min = v[0];
+    size_t n = v.size();
+    s.median = n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+    for (size_t i = 0; i < n; ++i)
+        s.mean += v[i];
+    s.mean /= n;
+    for (size_t i = 0; i < n; ++i)
+        s.stddev += (v[i] - s.mean) * (v[i] - s.mean);
+    s.stddev = n > 1 ? std::sqrt(s.stddev / (n - 1)) : 0;
+    return s;
+}
+
+/* Runs argv to completion with stdout/stderr discarded; false on failure. */
+bool run(const std::vector<std::string> &args)
+{
+    std::vector<char *> argv;
+    for (size_t i = 0; i < args.size(); ++i)
+        argv.push_back(const_cast<char *>(args[i].c_str()));
+    argv.push_back(0);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        return false;
+    if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd >= 0) {
+            dup2(fd, 1);
+            dup2(fd, 2);
+            close(fd);
+        }
+        execv(argv[0], &argv[0]);
+        _exit(127);
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0)
+        ;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+class Scenario {
+public:
+    virtual ~Scenario() {}
+    virtual const char *name() const = 0;
+    virtual bool once() = 0;
+};
+
+class ParseScenario: public Scenario {
+    std::string m_file;
+public:
+    ParseScenario(const std::string &file): m_file(file) {}
+    const char *name() const { return "parse"; }
+    bool once()
+    {
+        MP4FileHandle fh = MP4Read(m_file.c_str());
+        if (fh == MP4_INVALID_FILE_HANDLE)
+            return false;
+        MP4Close(fh);
+        return true;
+    }
+};
+
+class CommandScenario: public Scenario {
+    const char *m_name;
+    std::vector<std::string> m_args;
+public:
+    CommandScenario(const char *name, const std::vector<std::string> &args)
+        : m_name(name), m_args(args) {}
+    const char *name() const { return m_name; }
+    bool once() { return run(m_args); }
+};
+
+bool measure(Scenario *sc, const BenchOption &opt)
+{
+    for (int i = 0; i < opt.warmup; ++i)
+        if (!sc->once())
+            return false;
+    std::vector<double> samples;
+    for (int i = 0; i < opt.runs; ++i) {
+        bench_clock::time_point t0 = bench_clock::now();
+        if (!sc->once())
+            return false;
+        samples.push_back(std::chrono::duration<double, std::milli>(
+                    bench_clock::now() - t0).count());
+    }
+    Stats s = summarize(samples);
+    std::printf("%-10s %10.2f %10.2f %10.2f %10.2f\n",
+                sc->name(), s.min, s.median, s.mean, s.stddev);
+    std::fflush(stdout);
+    return true;
+}
+
+bool selected(const BenchOption &opt, const char *name)
+{
+    if (opt.only.empty())
+        return true;
+    std::string list = "," + opt.only + ",";
+    return list.find(std::string(",") + name + ",") != std::string::npos;
+}
+
+void usage()
+{
+    std::fprintf(stderr,
+"usage: mp4bench [options] [-- mp4gen options]\n"
+"  -n <runs>        Timed runs per scenario (default 10)\n"
+"  -w <runs>        Untimed warmup runs per scenario (default 2)\n"
+"  -m <path>        mp4fpsmod binary (default ./mp4fpsmod)\n"
+"  -g <path>        mp4gen binary (default ./mp4gen)\n"
+"  -d <dir>         Work directory (default: a fresh one under $TMPDIR)\n"
+"  -s <list>        Comma separated scenarios to run:\n"
+"                   parse,print,fps,tc,tc-c,copy (default all)\n"
+"  -k               Keep the work directory\n");
+    std::exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    BenchOption opt;
+    int ch;
+    while ((ch = getopt(argc, argv, "n:w:m:g:d:s:k")) != EOF) {
+        if (ch == 'n')
+            opt.runs = std::max(1, std::atoi(optarg));
+        else if (ch == 'w')
+            opt.warmup = std::max(0, std::atoi(optarg));
+        else if (ch == 'm')
+            opt.mp4fpsmod = optarg;
+        else if (ch == 'g')
+            opt.mp4gen = optarg;
+        else if (ch == 'd')
+            opt.workdir = optarg;
+        else if (ch == 's')
+            opt.only = optarg;
+        else if (ch == 'k')
+            opt.keep = true;
+        else
+            usage();
+    }
+    for (int i = optind; i < argc; ++i)
+        opt.genArgs.push_back(argv[i]);
+
+    bool created = false;
+    if (opt.workdir.empty()) {
+        const char *tmp = std::getenv("TMPDIR");
+        std::string tmpl = std::string(tmp ? tmp : "/tmp")
+                         + "/mp4bench.XXXXXX";
+        std::vector<char> buf(tmpl.begin(), tmpl.end());
+        buf.push_back(0);
+        if (!mkdtemp(&buf[0])) {
+            std::perror("mkdtemp");
+            return 2;
+        }
+        opt.workdir = &buf[0];
+        created = true;
+    }
+    std::string src = opt.workdir + "/src.mp4";
+    std::string dst = opt.workdir + "/dst.mp4";
+    std::string tc = opt.workdir + "/tc.txt";
+
+    MP4LogSetLevel(MP4_LOG_NONE);
+
+    std::vector<std::string> gen;
+    gen.push_back(opt.mp4gen);
+    gen.insert(gen.end(), opt.genArgs.begin(), opt.genArgs.end());
+    gen.push_back("-o");
+    gen.push_back(src);
+    bench_clock::time_point t0 = bench_clock::now();
+    if (!run(gen)) {
+        std::fprintf(stderr, "mp4gen failed\n");
+        return 2;
+    }
+    double genTime = std::chrono::duration<double>(
+            bench_clock::now() - t0).count();
+
+    std::vector<std::string> print;
+    print.push_back(opt.mp4fpsmod);
+    print.push_back("-p");
+    print.push_back(tc);
+    print.push_back(src);
+    if (!run(print)) {
+        std::fprintf(stderr, "%s -p failed\n", opt.mp4fpsmod.c_str());
+        return 2;
+    }
+
+    struct stat st;
+    stat(src.c_str(), &st);
+    std::printf("fixture: %s (%.1f MiB, generated in %.2fs)\n",
+                src.c_str(), st.st_size / 1048576.0, genTime);
+    std::printf("runs: %d, warmup: %d, times in ms\n\n", opt.runs, opt.warmup);
+    std::printf("%-10s %10s %10s %10s %10s\n",
+                "scenario", "min", "median", "mean", "stddev");
+
+    std::vector<Scenario *> scenarios;
+    scenarios.push_back(new ParseScenario(src));
+    {
+        std::vector<std::string> a(print);
+        a[2] = opt.workdir + "/print.txt";
+        scenarios.push_back(new CommandScenario("print", a));
+    }
+    {
+        std::vector<std::string> a;
+        a.push_back(opt.mp4fpsmod);
+        a.push_back("-r");
+        a.push_back("0:24000/1001");
+        a.push_back("-o");
+        a.push_back(dst);
+        a.push_back(src);
+        scenarios.push_back(new CommandScenario("fps", a));
+
+        a[1] = "-t";
+        a[2] = tc;
+        scenarios.push_back(new CommandScenario("tc", a));
+
+        a.insert(a.begin() + 3, "-c");
+        scenarios.push_back(new CommandScenario("tc-c", a));
+    }
+    {
+        std::vector<std::string> a;
+        a.push_back(opt.mp4fpsmod);
+        a.push_back("-o");
+        a.push_back(dst);
+        a.push_back(src);
+        scenarios.push_back(new CommandScenario("copy", a));
+    }
+
+    int rc = 0;
+    for (size_t i = 0; i < scenarios.size(); ++i) {
+        if (selected(opt, scenarios[i]->name())
+                && !measure(scenarios[i], opt)) {
+            std::fprintf(stderr, "%s: failed\n", scenarios[i]->name());
+            rc = 2;
+        }
+        delete scenarios[i];
+    }
+
+    if (!opt.keep) {
+        unlink(src.c_str());
+        unlink(dst.c_str());
+        unlink(tc.c_str());
+        unlink((opt.workdir + "/print.txt").c_str());
+        if (created)
+            rmdir(opt.workdir.c_str());
+    }
+    return rc;
+}
@@ -0,0 +1,181 @@
+/*
+ * mp4gen: build a synthetic H.264/AAC mp4 through the mp4v2 writer API.
+ *
+ * Sample payloads are filler bytes; only the container layout (sample
+ * tables, B-frame reordering, chunking, interleave) is meaningful, which
+ * is all mp4fpsmod looks at.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <getopt.h>
+#include <mp4v2/mp4v2.h>
+
+struct GenOption {
+    const char *dst;
+    uint32_t frames;
+    uint32_t fps_num, fps_denom;
+    uint32_t bframes;
+    uint32_t keyint;
+    uint32_t audioTracks;
+    uint32_t chunkMs;
+    uint32_t frameSize;
+    uint64_t targetSize;
+
+    GenOption()
+    {
+        dst = 0;
+        frames = 3000;
+        fps_num = 30000;
+        fps_denom = 1001;
+        bframes = 2;
+        keyint = 30;
+        audioTracks = 1;
+        chunkMs = 1000;
+        frameSize = 4000;
+        targetSize = 0;
+    }
+};
+
+const uint32_t AUDIO_RATE = 48000;
+const uint32_t AUDIO_FRAME = 1024;
+const uint32_t AUDIO_FRAME_SIZE = 300;
+
+/*
+ * Display index of the n-th frame in decode order, for a stream coded as
+ * I (P B..B)(P B..B)... with `bframes` B-frames between anchors.
+ */
+uint32_t displayIndex(uint32_t n, uint32_t bframes, uint32_t frames)
+{
+    if (n == 0 || bframes == 0)
+        return n;
+    uint32_t m = bframes + 1;
+    uint32_t start = 1 + (n - 1) / m * m;
+    uint32_t len = std::min(m, frames - start);
+    uint32_t pos = n - start;
+    return pos == 0 ? start + len - 1 : start + pos - 1;
+}
+
+void usage()
+{
+    std::fprintf(stderr,
+"usage: mp4gen [options] -o FILE\n"
+"  -n <frames>      Number of video frames (default 3000)\n"
+"  -r <fps>         Video frame rate, integer or rational (default 30000/1001)\n"
+"  -b <n>           B-frames between anchor frames (default 2)\n"
+"  -k <n>           Key frame interval (default 30)\n"
+"  -a <n>           Number of audio tracks (default 1)\n"
+"  -c <ms>          Chunk duration in milliseconds (default 1000)\n"
+"  -s <bytes>       Average video frame size (default 4000)\n"
+"  -S <MiB>         Target file size; overrides -s\n");
+    std::exit(1);
+}
+
+void generate(const GenOption &opt)
+{
+    const uint32_t videoScale = 90000;
+    const uint32_t delta = static_cast<uint64_t>(videoScale) * opt.fps_denom
+                           / opt.fps_num;
+    uint32_t frameSize = opt.frameSize;
+    if (opt.targetSize) {
+        double seconds = static_cast<double>(opt.frames) * delta / videoScale;
+        double audio = seconds * AUDIO_RATE / AUDIO_FRAME
+                     * AUDIO_FRAME_SIZE * opt.audioTracks;
+        double video = opt.targetSize - audio;
+        frameSize = video > opt.frames ? video / opt.frames : 1;
+    }
+
+    MP4FileHandle file = MP4Create(opt.dst, MP4_CREATE_64BIT_DATA);
+    if (file == MP4_INVALID_FILE_HANDLE) {
+        std::fprintf(stderr, "can't create %s\n", opt.dst);
+        std::exit(2);
+    }
+    MP4SetTimeScale(file, videoScale);
+
+    static const uint8_t sps[] = { 0x67, 0x64, 0x00, 0x1f, 0xac, 0xd9, 0x40 };
+    static const uint8_t pps[] = { 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0 };
+    MP4TrackId video = MP4AddH264VideoTrack(file, videoScale, delta,
+                                            1280, 720, 0x64, 0x00, 0x1f, 3);
+    MP4AddH264SequenceParameterSet(file, video, sps, sizeof sps);
+    MP4AddH264PictureParameterSet(file, video, pps, sizeof pps);
+    MP4SetTrackDurationPerChunk(file, video,
+            static_cast<uint64_t>(videoScale) * opt.chunkMs / 1000);
+
+    std::vector<MP4TrackId> audio;
+    for (uint32_t i = 0; i < opt.audioTracks; ++i) {
+        MP4TrackId id = MP4AddAudioTrack(file, AUDIO_RATE, AUDIO_FRAME);
+        MP4SetTrackDurationPerChunk(file, id,
+                static_cast<uint64_t>(AUDIO_RATE) * opt.chunkMs / 1000);
+        audio.push_back(id);
+    }
+
+    std::vector<uint8_t> payload(frameSize * 2 + AUDIO_FRAME_SIZE);
+    for (size_t i = 0; i < payload.size(); ++i)
+        payload[i] = static_cast<uint8_t>(i * 131 + 7);
+
+    uint64_t audioFrames = 0;
+    uint32_t shift = opt.bframes ? 1 : 0;
+    for (uint32_t n = 0; n < opt.frames; ++n) {
+        uint32_t disp = displayIndex(n, opt.bframes, opt.frames);
+        MP4Duration offset =
+            (static_cast<int64_t>(disp) + shift - n) * delta;
+        bool anchor = n == 0 || (n - 1) % (opt.bframes + 1) == 0;
+        bool sync = anchor && disp % opt.keyint == 0;
+        /* vary frame sizes a little so stsz is not constant */
+        uint32_t size = frameSize / 2 + (n * 2654435761u) % (frameSize + 1);
+        if (!MP4WriteSample(file, video, &payload[0], size, delta, offset,
+                            sync)) {
+            std::fprintf(stderr, "MP4WriteSample failed\n");
+            std::exit(2);
+        }
+        uint64_t videoEnd = static_cast<uint64_t>(n + 1) * delta;
+        while (audioFrames * AUDIO_FRAME * videoScale
+               < videoEnd * AUDIO_RATE) {
+            for (size_t i = 0; i < audio.size(); ++i)
+                MP4WriteSample(file, audio[i], &payload[0], AUDIO_FRAME_SIZE,
+                               AUDIO_FRAME, 0, true);
+            ++audioFrames;
+        }
+    }
+    MP4Close(file);
+}
+
+int main(int argc, char **argv)
+{
+    GenOption opt;
+    int ch;
+    while ((ch = getopt(argc, argv, "o:n:r:b:k:a:c:s:S:")) != EOF) {
+        unsigned v;
+        if (ch == 'o')
+            opt.dst = optarg;
+        else if (ch == 'r') {
+            unsigned num, denom = 1;
+            if (std::sscanf(optarg, "%u/%u", &num, &denom) < 1
+                    || !num || !denom)
+                usage();
+            opt.fps_num = num;
+            opt.fps_denom = denom;
+        } else if (ch == '?' || std::sscanf(optarg, "%u", &v) != 1)
+            usage();
+        else if (ch == 'n')
+            opt.frames = v;
+        else if (ch == 'b')
+            opt.bframes = v;
+        else if (ch == 'k')
+            opt.keyint = v ? v : 1;
+        else if (ch == 'a')
+            opt.audioTracks = v;
+        else if (ch == 'c')
+            opt.chunkMs = v ? v : 1;
+        else if (ch == 's')
+            opt.frameSize = v ? v : 1;
+        else if (ch == 'S')
+            opt.targetSize = static_cast<uint64_t>(v) << 20;
+    }
+    if (!opt.dst || !opt.frames)
+        usage();
+    generate(opt);
+    return 0;
+}
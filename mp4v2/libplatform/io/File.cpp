@@ -1,9 +1,124 @@
 #include "libplatform/impl.h"
+#include <list>
+#include <unordered_map>
 
 namespace mp4v2 { namespace platform { namespace io {
 
 ///////////////////////////////////////////////////////////////////////////////
 
+bool
+FileProvider::readv( const Segment* segments, int count, Size& nin )
+{
+    nin = 0;
+    for( int i = 0; i < count; i++ ) {
+        Size n = 0;
+        if( read( segments[i].buffer, segments[i].size, n ))
+            return true;
+        nin += n;
+    }
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Page cache of a File, see File::setCache().
+ *
+ * Pages live in a list kept in LRU order, most recent first, and are found
+ * by page number through a hash map. A page's buffer is recycled when it
+ * is evicted; dropped pages are numbered -1 and go to the back, to be
+ * recycled first. Only the bytes up to the end of the file are valid.
+ */
+class File::Cache
+{
+public:
+    struct Page {
+        Size                 number;
+        Size                 length;
+        std::vector<uint8_t> data;
+    };
+    typedef std::list<Page> PageList;
+
+    Cache( Size pageSize_, int maxPages_ )
+        : pageSize         ( pageSize_ )
+        , maxPages         ( maxPages_ )
+        , providerPosition ( 0 )
+        , lastEnd          ( -1 )
+        , readAhead        ( 0 )
+    {
+    }
+
+    // moves the page to the front
+    Page* find( Size number )
+    {
+        std::unordered_map<Size, PageList::iterator>::iterator it = index.find( number );
+        if( it == index.end() )
+            return NULL;
+        pages.splice( pages.begin(), pages, it->second );
+        return &*it->second;
+    }
+
+    // a page to fill, at the front; its contents are undefined
+    Page& insert( Size number )
+    {
+        drop( number );
+        if( (int)pages.size() < maxPages ) {
+            pages.push_front( Page() );
+            pages.front().data.resize( (size_t)pageSize );
+        }
+        else {
+            index.erase( pages.back().number );
+            pages.splice( pages.begin(), pages, --pages.end() );
+        }
+        Page& page = pages.front();
+        page.number = number;
+        page.length = 0;
+        index[number] = pages.begin();
+        return page;
+    }
+
+    void drop( Size number )
+    {
+        std::unordered_map<Size, PageList::iterator>::iterator it = index.find( number );
+        if( it == index.end() )
+            return;
+        pages.splice( pages.end(), pages, it->second );
+        pages.back().number = -1;
+        pages.back().length = 0;
+        index.erase( it );
+    }
+
+    // drops the pages overlapping [begin, end)
+    void invalidate( Size begin, Size end )
+    {
+        if( index.empty() || begin >= end )
+            return;
+        for( Size n = begin / pageSize; n <= (end - 1) / pageSize; n++ )
+            drop( n );
+    }
+
+    void clear()
+    {
+        index.clear();
+        for( PageList::iterator it = pages.begin(); it != pages.end(); ++it ) {
+            it->number = -1;
+            it->length = 0;
+        }
+    }
+
+    const Size pageSize;
+    const int  maxPages;
+    Size       providerPosition;
+    Size       lastEnd;    // end of the last read, for sequential detection
+    int        readAhead;  // pages
+
+private:
+    PageList pages;
+    std::unordered_map<Size, PageList::iterator> index;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
 File::File( const std::string& name_, Mode mode_, FileProvider* provider_ )
     : _name     ( name_ )
     , _isOpen   ( false )
@@ -11,6 +126,7 @@ File::File( const std::string& name_, Mode mode_, FileProvider* provider_ )
     , _size     ( 0 )
     , _position ( 0 )
     , _provider ( provider_ ? *provider_ : standard() )
+    , _cache    ( provider_ ? new Cache( CACHE_PAGE_SIZE, CACHE_PAGES ) : NULL )
     , name      ( _name )
     , isOpen    ( _isOpen )
     , mode      ( _mode )
@@ -24,6 +140,7 @@ File::File( const std::string& name_, Mode mode_, FileProvider* provider_ )
 File::~File()
 {
     close();
+    delete _cache;
     delete &_provider;
 }
 
@@ -60,6 +177,14 @@ File::open( const std::string& name_, Mode mode_ )
     if( _provider.getSize( _size ))
         return true;
 
+    _position = 0;
+    if( _cache ) {
+        _cache->clear();
+        _cache->providerPosition = 0;
+        _cache->lastEnd = -1;
+        _cache->readAhead = 0;
+    }
+
     _isOpen = true;
     return false;
 }
@@ -70,7 +195,8 @@ File::seek( Size pos )
     if( !_isOpen )
         return true;
 
-    if( _provider.seek( pos ))
+    // with a cache, the provider is only moved when it is used
+    if( !_cache && _provider.seek( pos ))
         return true;
     _position = pos;
     return false;
@@ -84,12 +210,37 @@ File::read( void* buffer, Size size, Size& nin )
     if( !_isOpen )
         return true;
 
-    if( _provider.read( buffer, size, nin ))
+    if( _cache && size < _cache->pageSize )
+        return readCached( buffer, size, nin );
+
+    if( syncPosition() || _provider.read( buffer, size, nin ))
+        return true;
+
+    _position += nin;
+    if( _position > _size )
+        _size = _position;
+    if( _cache )
+        _cache->providerPosition = _cache->lastEnd = _position;
+
+    return false;
+}
+
+bool
+File::readv( const Segment* segments, int count, Size& nin )
+{
+    nin = 0;
+
+    if( !_isOpen )
+        return true;
+
+    if( syncPosition() || _provider.readv( segments, count, nin ))
         return true;
 
     _position += nin;
     if( _position > _size )
         _size = _position;
+    if( _cache )
+        _cache->providerPosition = _cache->lastEnd = _position;
 
     return false;
 }
@@ -102,12 +253,23 @@ File::write( const void* buffer, Size size, Size& nout )
     if( !_isOpen )
         return true;
 
+    if( syncPosition() )
+        return true;
+
+    if( _cache ) {
+        // a short last page gets stale once the file grows past it
+        Size begin = _position < _size ? _position : _size;
+        _cache->invalidate( begin, _position + size );
+    }
+
     if( _provider.write( buffer, size, nout ))
         return true;
 
     _position += nout;
     if( _position > _size )
         _size = _position;
+    if( _cache )
+        _cache->providerPosition = _position;
 
     return false;
 }
@@ -118,6 +280,9 @@ File::truncate( Size size )
     if( !_isOpen )
         return true;
 
+    if( _cache )
+        _cache->clear();
+
     if( _provider.truncate( size ))
         return true;
 
@@ -134,6 +299,8 @@ File::close()
     if( _provider.close() )
         return true;
 
+    if( _cache )
+        _cache->clear();
     _isOpen = false;
     return false;
 }
@@ -147,6 +314,147 @@ File::getSize( Size& nout )
     return _provider.getSize( nout );
 }
 
+bool
+File::preallocate( Size size )
+{
+    if( !_isOpen )
+        return true;
+
+    return _provider.preallocate( size );
+}
+
+bool
+File::sync()
+{
+    if( !_isOpen )
+        return true;
+
+    return _provider.sync();
+}
+
+void
+File::setStreaming( bool enable )
+{
+    if( _isOpen )
+        _provider.setStreaming( enable );
+}
+
+void
+File::setCache( Size pageSize, int pages )
+{
+    if( _isOpen && syncPosition() )
+        return;
+
+    delete _cache;
+    _cache = NULL;
+    if( pageSize > 0 && pages > 0 ) {
+        _cache = new Cache( pageSize, pages );
+        _cache->providerPosition = _position;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// moves the provider to the file position, after cached reads and seeks
+bool
+File::syncPosition()
+{
+    if( !_cache || _cache->providerPosition == _position )
+        return false;
+
+    if( _provider.seek( _position ))
+        return true;
+    _cache->providerPosition = _position;
+    return false;
+}
+
+bool
+File::readCached( void* buffer, Size size, Size& nin )
+{
+    Cache& cache = *_cache;
+    const bool sequential = _position == cache.lastEnd;
+
+    Size pos = _position;
+    Size end = _position + size;
+    if( end > _size )
+        end = _size;
+
+    while( pos < end ) {
+        const Size number = pos / cache.pageSize;
+        Cache::Page* page = cache.find( number );
+        if( !page ) {
+            if( fillCache( number, sequential ))
+                return true;
+            page = cache.find( number );
+        }
+
+        const Size offset = pos - number * cache.pageSize;
+        if( offset >= page->length )
+            break;
+        Size n = page->length - offset;
+        if( n > end - pos )
+            n = end - pos;
+        memcpy( (uint8_t*)buffer + (pos - _position), &page->data[(size_t)offset], (size_t)n );
+        pos += n;
+    }
+
+    nin = pos - _position;
+    _position = pos;
+    cache.lastEnd = pos;
+    return false;
+}
+
+// reads the page, and the read-ahead run behind it, in one request
+bool
+File::fillCache( Size number, bool sequential )
+{
+    Cache& cache = *_cache;
+
+    if( sequential ) {
+        cache.readAhead = cache.readAhead ? cache.readAhead * 2 : 1;
+        if( cache.readAhead > cache.maxPages / 4 )
+            cache.readAhead = cache.maxPages / 4;
+    }
+    else {
+        cache.readAhead = 0;
+    }
+
+    const Size lastPage = _size > 0 ? (_size - 1) / cache.pageSize : 0;
+    std::vector<Segment> segments;
+    std::vector<Cache::Page*> filled;
+    for( Size n = number; n <= number + cache.readAhead && n <= lastPage; n++ ) {
+        if( n > number && cache.find( n ))
+            break;
+        Cache::Page& page = cache.insert( n );
+        Segment segment = { &page.data[0], cache.pageSize };
+        segments.push_back( segment );
+        filled.push_back( &page );
+    }
+    if( segments.empty() ) {
+        // past the end of file: an empty page
+        cache.insert( number );
+        return false;
+    }
+
+    const Size start = number * cache.pageSize;
+    Size nin = 0;
+    if( (cache.providerPosition != start && _provider.seek( start ))
+            || _provider.readv( &segments[0], (int)segments.size(), nin )) {
+        cache.providerPosition = -1;
+        for( size_t i = 0; i < filled.size(); i++ )
+            cache.drop( filled[i]->number );
+        return true;
+    }
+    cache.providerPosition = start + nin;
+
+    for( size_t i = 0; i < filled.size(); i++ ) {
+        const Size off = (Size)i * cache.pageSize;
+        filled[i]->length = nin <= off ? 0
+            : nin - off < cache.pageSize ? nin - off : cache.pageSize;
+    }
+    return false;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 CustomFileProvider::CustomFileProvider( const MP4FileProvider& provider )
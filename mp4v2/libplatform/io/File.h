@@ -22,6 +22,12 @@ public:
     //! type used to represent all file sizes and offsets
     typedef int64_t Size;
 
+    //! one destination buffer of a scatter read
+    struct Segment {
+        void* buffer;
+        Size  size;
+    };
+
 public:
     virtual ~FileProvider() { }
 
@@ -33,6 +39,16 @@ public:
     virtual bool close() = 0;
     virtual bool getSize( Size& nout ) = 0;
 
+    // Reads one by one unless the provider can do better.
+    virtual bool readv( const Segment* segments, int count, Size& nin );
+
+    // Providers without access to stable storage have nothing to sync.
+    virtual bool sync() { return false; }
+
+    // Hints; providers that cannot act on them ignore them.
+    virtual bool preallocate( Size ) { return false; }
+    virtual void setStreaming( bool ) { }
+
 protected:
     FileProvider() { }
 };
@@ -52,6 +68,12 @@ protected:
 class MP4V2_EXPORT File : public FileProvider
 {
 public:
+    //! default page cache geometry for supplied providers, see #setCache
+    enum {
+        CACHE_PAGE_SIZE = 64 * 1024,
+        CACHE_PAGES     = 64
+    };
+
     ///////////////////////////////////////////////////////////////////////////
     //!
     //! Constructor.
@@ -68,6 +90,8 @@ public:
     //! @param provider a fileprovider instance. If NULL a standard file
     //!     provider will be used otherwise the supplied provider must be
     //!     new-allocated and will be delete'd via ~File().
+    //!     Reads from a supplied provider go through a page cache of
+    //!     #CACHE_PAGES pages of #CACHE_PAGE_SIZE bytes; see #setCache.
     //!
     ///////////////////////////////////////////////////////////////////////////
 
@@ -146,6 +170,25 @@ public:
 
     bool read( void* buffer, Size size, Size& nin );
 
+    ///////////////////////////////////////////////////////////////////////////
+    //!
+    //! Binary stream scatter read.
+    //!
+    //! The function reads consecutive bytes from file into each of
+    //! <b>segments</b> in turn, as if read() was called for every one of
+    //! them, but lets the provider do it with a single vectored request.
+    //! The number of bytes actually read are returned in <b>nin</b>.
+    //!
+    //! @param segments buffers to fill, in file order.
+    //! @param count number of segments.
+    //! @param nin output indicating number of bytes read from file.
+    //!
+    //! @return true on failure, false on success.
+    //!
+    ///////////////////////////////////////////////////////////////////////////
+
+    bool readv( const Segment* segments, int count, Size& nin );
+
     ///////////////////////////////////////////////////////////////////////////
     //!
     //! Binary stream write.
@@ -188,13 +231,88 @@ public:
 
     bool getSize( Size& nout );
 
+    ///////////////////////////////////////////////////////////////////////////
+    //!
+    //! Commit written data to stable storage.
+    //!
+    //! Pending writes are flushed, and the function returns once the
+    //! data has reached the disk (fdatasync() or equivalent), so that it
+    //! survives a crash of the process or the system.
+    //!
+    //! @return true on failure, false on success.
+    //!
+    ///////////////////////////////////////////////////////////////////////////
+
+    bool sync();
+
+    ///////////////////////////////////////////////////////////////////////////
+    //!
+    //! Reserve disk space for the file up to size bytes.
+    //!
+    //! The file size seen by readers is not changed; space reserved
+    //! beyond the final size is released when the file is closed.
+    //! This is only a hint, and a no-op where unsupported.
+    //!
+    //! @param size expected final size of the file in bytes.
+    //!
+    //! @return true on failure, false on success.
+    //!
+    ///////////////////////////////////////////////////////////////////////////
+
+    bool preallocate( Size size );
+
+    ///////////////////////////////////////////////////////////////////////////
+    //!
+    //! Declare that the file is read or written once, front to back.
+    //!
+    //! When enabled, the provider may read ahead more aggressively, start
+    //! writeback early, and drop data behind the file position from the
+    //! OS cache. This is only a hint, and a no-op where unsupported.
+    //!
+    //! @param enable true to enable streaming access.
+    //!
+    ///////////////////////////////////////////////////////////////////////////
+
+    void setStreaming( bool enable );
+
+    ///////////////////////////////////////////////////////////////////////////
+    //!
+    //! Configure the page cache.
+    //!
+    //! Reads smaller than a page are served from a cache of fixed size,
+    //! page aligned blocks of the file, with LRU eviction. A miss reads the
+    //! page from the provider together with a read-ahead run of following
+    //! pages, which grows while reads go forward and collapses on a jump,
+    //! so that atom headers and small samples cost a provider request
+    //! every few pages instead of one each. Larger reads, scatter reads
+    //! and writes go to the provider directly; writes and truncation drop
+    //! the pages they touch. Seeks are deferred until the provider is
+    //! actually used.
+    //!
+    //! The standard providers buffer reads themselves, so the cache is off
+    //! for them unless enabled here.
+    //!
+    //! @param pageSize page size in bytes.
+    //! @param pages number of pages to keep, or 0 to disable the cache.
+    //!
+    ///////////////////////////////////////////////////////////////////////////
+
+    void setCache( Size pageSize, int pages );
+
 private:
+    class Cache;
+
+    bool syncPosition();
+    bool readCached( void* buffer, Size size, Size& nin );
+    bool fillCache( Size page, bool sequential );
+
     std::string   _name;
     bool          _isOpen;
     Mode          _mode;
     Size          _size;
     Size          _position;
     FileProvider& _provider;
+    Cache*        _cache;
 
 public:
     const std::string& name;      //!< read-only: file pathname or empty-string if not applicable
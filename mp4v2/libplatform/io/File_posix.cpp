@@ -1,94 +1,373 @@
 #include "libplatform/impl.h"
+#include <sys/stat.h>
+
+// preadv() is missing from older macOS SDKs
+#if !defined( __APPLE__ )
+#   include <sys/uio.h>
+#   define MP4V2_HAVE_PREADV
+#endif
 
 namespace mp4v2 { namespace platform { namespace io {
 
 ///////////////////////////////////////////////////////////////////////////////
 
+/*
+ * File descriptor based provider.
+ *
+ * All IO goes through pread()/pwrite() at an explicit offset, so seek() is
+ * just bookkeeping. Sequential writes are collected in a large page aligned
+ * write-behind buffer, and small reads (atom headers, sample table fields)
+ * are served from a read cache holding the surrounding bytes. Reads flush
+ * pending writes first, writes invalidate the read cache. Scatter reads
+ * bypass the cache and go out as a single preadv() where available.
+ *
+ * In streaming mode, data behind a sequential run of reads or writes is
+ * dropped from the page cache as the run advances; for writes, writeback
+ * is started right away and waited for before the drop, so that dirty
+ * pages never pile up. Drops are made in whole, aligned windows: the
+ * kernel skips large folios that a range only partly covers.
+ */
 class StandardFileProvider : public FileProvider
 {
 public:
     StandardFileProvider();
+    ~StandardFileProvider();
 
     bool open( const std::string& name, Mode mode );
     bool seek( Size pos );
     bool read( void* buffer, Size size, Size& nin );
+    bool readv( const Segment* segments, int count, Size& nin );
     bool write( const void* buffer, Size size, Size& nout );
     bool truncate( Size size );
     bool close();
     bool getSize( Size& nout );
+    bool sync();
+    bool preallocate( Size size );
+    void setStreaming( bool enable );
 
 private:
-    bool         _seekg;
-    bool         _seekp;
-    std::fstream _fstream;
-    std::string  _name;
+    enum {
+        WRITE_BUFFER_SIZE = 1024 * 1024,
+        READ_CACHE_SIZE   = 64 * 1024,
+        BUFFER_ALIGNMENT  = 4096,
+        STREAMING_WINDOW  = 8 * 1024 * 1024,
+        MAX_SEGMENTS      = 256,  // per preadv(), well under IOV_MAX
+    };
+
+    bool flush();
+    bool preadFully( void* buffer, Size size, Size offset, Size& nin );
+    bool pwriteFully( const void* buffer, Size size, Size offset );
+    uint8_t* allocBuffer( size_t size );
+    void readBehind( Size offset, Size size );
+    void writeBehind( Size offset, Size size );
+
+    int      _fd;
+    Size     _position;
+
+    uint8_t* _writeBuffer;
+    Size     _writeStart;
+    Size     _writeLength;
+
+    uint8_t* _readCache;
+    Size     _readStart;
+    Size     _readLength;
+
+    bool     _streaming;
+    Size     _readRunStart;
+    Size     _readRunEnd;
+    Size     _writeRunStart;
+    Size     _writeRunEnd;
+    Size     _preallocated;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
 
 StandardFileProvider::StandardFileProvider()
-    : _seekg ( false )
-    , _seekp ( false )
+    : _fd          ( -1 )
+    , _position    ( 0 )
+    , _writeBuffer ( NULL )
+    , _writeStart  ( 0 )
+    , _writeLength ( 0 )
+    , _readCache   ( NULL )
+    , _readStart   ( 0 )
+    , _readLength  ( 0 )
+    , _streaming   ( false )
+    , _readRunStart  ( 0 )
+    , _readRunEnd    ( 0 )
+    , _writeRunStart ( 0 )
+    , _writeRunEnd   ( 0 )
+    , _preallocated  ( 0 )
+{
+}
+
+StandardFileProvider::~StandardFileProvider()
+{
+    close();
+    free( _writeBuffer );
+    free( _readCache );
+}
+
+uint8_t*
+StandardFileProvider::allocBuffer( size_t size )
 {
+    void* p;
+    if( posix_memalign( &p, BUFFER_ALIGNMENT, size ))
+        return NULL;
+    return (uint8_t*)p;
 }
 
 bool
 StandardFileProvider::open( const std::string& name, Mode mode )
 {
-    ios::openmode om = ios::binary;
+    int flags;
     switch( mode ) {
         case MODE_UNDEFINED:
         case MODE_READ:
         default:
-            om |= ios::in;
-            _seekg = true;
-            _seekp = false;
+            flags = O_RDONLY;
             break;
 
         case MODE_MODIFY:
-            om |= ios::in | ios::out;
-            _seekg = true;
-            _seekp = true;
+            flags = O_RDWR;
             break;
 
         case MODE_CREATE:
-            om |= ios::in | ios::out | ios::trunc;
-            _seekg = true;
-            _seekp = true;
+            flags = O_RDWR | O_CREAT | O_TRUNC;
             break;
     }
+#ifdef O_CLOEXEC
+    flags |= O_CLOEXEC;
+#endif
+
+    _fd = ::open( name.c_str(), flags, 0666 );
+    if( _fd < 0 )
+        return true;
 
-    _fstream.open( name.c_str(), om );
-    _name = name;
-    return _fstream.fail();
+    _position = 0;
+    _writeLength = 0;
+    _readLength = 0;
+    _streaming = false;
+    _readRunStart = _readRunEnd = 0;
+    _writeRunStart = _writeRunEnd = 0;
+    _preallocated = 0;
+    if( !_readCache )
+        _readCache = allocBuffer( READ_CACHE_SIZE );
+    if( flags & O_RDWR && !_writeBuffer )
+        _writeBuffer = allocBuffer( WRITE_BUFFER_SIZE );
+    if( !_readCache || ( flags & O_RDWR && !_writeBuffer )) {
+        close();
+        errno = ENOMEM;
+        return true;
+    }
+    return false;
 }
 
 bool
 StandardFileProvider::seek( Size pos )
 {
-    if( _seekg )
-        _fstream.seekg( pos, ios::beg );
-    if( _seekp )
-        _fstream.seekp( pos, ios::beg );
-    return _fstream.fail();
+    _position = pos;
+    return false;
+}
+
+bool
+StandardFileProvider::preadFully( void* buffer, Size size, Size offset, Size& nin )
+{
+    nin = 0;
+    while( nin < size ) {
+        ssize_t n = ::pread( _fd, (uint8_t*)buffer + nin, size - nin, offset + nin );
+        if( n < 0 ) {
+            if( errno == EINTR )
+                continue;
+            return true;
+        }
+        if( n == 0 )
+            break;
+        nin += n;
+    }
+    if( _streaming )
+        readBehind( offset, nin );
+    return false;
+}
+
+bool
+StandardFileProvider::pwriteFully( const void* buffer, Size size, Size offset )
+{
+    Size nout = 0;
+    while( nout < size ) {
+        ssize_t n = ::pwrite( _fd, (const uint8_t*)buffer + nout, size - nout, offset + nout );
+        if( n < 0 ) {
+            if( errno == EINTR )
+                continue;
+            return true;
+        }
+        nout += n;
+    }
+    if( _streaming )
+        writeBehind( offset, size );
+    return false;
+}
+
+void
+StandardFileProvider::readBehind( Size offset, Size size )
+{
+#if defined( POSIX_FADV_DONTNEED )
+    // interleaved tracks make reads hop back and forth a little, and
+    // cache refills overlap; anything near the run continues it
+    if( offset < _readRunStart || offset > _readRunEnd + STREAMING_WINDOW ) {
+        _readRunStart = offset;
+        _readRunEnd = offset;
+    }
+    _readRunEnd = std::max( _readRunEnd, offset + size );
+
+    // keep the last window cached, drop the one before it
+    Size end = ( _readRunEnd - STREAMING_WINDOW ) & ~Size( STREAMING_WINDOW - 1 );
+    if( end - _readRunStart >= STREAMING_WINDOW ) {
+        ::posix_fadvise( _fd, _readRunStart, end - _readRunStart, POSIX_FADV_DONTNEED );
+        _readRunStart = end;
+    }
+#endif
+}
+
+void
+StandardFileProvider::writeBehind( Size offset, Size size )
+{
+    if( offset != _writeRunEnd )
+        _writeRunStart = offset;
+    _writeRunEnd = offset + size;
+
+#if defined( SYNC_FILE_RANGE_WRITE )
+    // start writeback of what was just written
+    ::sync_file_range( _fd, offset, size, SYNC_FILE_RANGE_WRITE );
+#endif
+
+    // keep the last window dirty/cached, retire the one before it
+    Size end = ( _writeRunEnd - STREAMING_WINDOW ) & ~Size( STREAMING_WINDOW - 1 );
+    if( _writeRunEnd < STREAMING_WINDOW || end - _writeRunStart < STREAMING_WINDOW )
+        return;
+#if defined( SYNC_FILE_RANGE_WRITE )
+    ::sync_file_range( _fd, _writeRunStart, end - _writeRunStart,
+        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER );
+#endif
+#if defined( POSIX_FADV_DONTNEED )
+    ::posix_fadvise( _fd, _writeRunStart, end - _writeRunStart, POSIX_FADV_DONTNEED );
+#endif
+    _writeRunStart = end;
+}
+
+bool
+StandardFileProvider::flush()
+{
+    if( !_writeLength )
+        return false;
+    bool failed = pwriteFully( _writeBuffer, _writeLength, _writeStart );
+    _writeLength = 0;
+    return failed;
 }
 
 bool
 StandardFileProvider::read( void* buffer, Size size, Size& nin )
 {
-    _fstream.read( (char*)buffer, size );
-    if( _fstream.fail() )
+    if( flush() )
         return true;
-    nin = _fstream.gcount();
-    return false;
+
+    // served from, or through, the read cache
+    if( size < READ_CACHE_SIZE ) {
+        if( _position < _readStart || _position + size > _readStart + _readLength ) {
+            if( preadFully( _readCache, READ_CACHE_SIZE, _position, _readLength )) {
+                _readLength = 0;
+                return true;
+            }
+            _readStart = _position;
+        }
+        nin = std::min( size, _readStart + _readLength - _position );
+        memcpy( buffer, _readCache + ( _position - _readStart ), nin );
+    }
+    else if( preadFully( buffer, size, _position, nin )) {
+        return true;
+    }
+
+    _position += nin;
+    // like std::istream::read, a short read is a failure
+    return nin < size;
 }
 
 bool
-StandardFileProvider::write( const void* buffer, Size size, Size& nout )
+StandardFileProvider::readv( const Segment* segments, int count, Size& nin )
 {
-    _fstream.write( (const char*)buffer, size );
-    if( _fstream.fail() )
+    nin = 0;
+    if( flush() )
         return true;
+
+    Size size = 0;
+    for( int i = 0; i < count; i++ )
+        size += segments[i].size;
+
+#if defined( MP4V2_HAVE_PREADV )
+    struct iovec iov[MAX_SEGMENTS];
+    int first = 0;
+    Size skip = 0;  // bytes of segments[first] already filled
+    while( nin < size ) {
+        int n = 0;
+        for( int i = first; i < count && n < MAX_SEGMENTS; i++, n++ ) {
+            Size offset = ( i == first ) ? skip : 0;
+            iov[n].iov_base = (uint8_t*)segments[i].buffer + offset;
+            iov[n].iov_len  = segments[i].size - offset;
+        }
+        ssize_t done = ::preadv( _fd, iov, n, _position + nin );
+        if( done < 0 ) {
+            if( errno == EINTR )
+                continue;
+            return true;
+        }
+        if( done == 0 )
+            break;
+        nin += done;
+        for( skip += done; first < count && skip >= segments[first].size; first++ )
+            skip -= segments[first].size;
+    }
+    if( _streaming )
+        readBehind( _position, nin );
+#else
+    for( int i = 0; i < count && nin < size; i++ ) {
+        Size n;
+        if( preadFully( segments[i].buffer, segments[i].size, _position + nin, n ))
+            return true;
+        nin += n;
+        if( n < segments[i].size )
+            break;
+    }
+#endif
+
+    _position += nin;
+    // like read(), a short read is a failure
+    return nin < size;
+}
+
+bool
+StandardFileProvider::write( const void* buffer, Size size, Size& nout )
+{
+    _readLength = 0;
+
+    // overwrite within, or append to, the pending block
+    if( _writeLength && ( _position < _writeStart
+            || _position > _writeStart + _writeLength
+            || _position + size > _writeStart + WRITE_BUFFER_SIZE )) {
+        if( flush() )
+            return true;
+    }
+
+    if( !_writeBuffer || ( !_writeLength && size >= WRITE_BUFFER_SIZE )) {
+        if( pwriteFully( buffer, size, _position ))
+            return true;
+    }
+    else {
+        if( !_writeLength )
+            _writeStart = _position;
+        memcpy( _writeBuffer + ( _position - _writeStart ), buffer, size );
+        _writeLength = std::max( _writeLength, _position + size - _writeStart );
+    }
+
+    _position += size;
     nout = size;
     return false;
 }
@@ -96,38 +375,76 @@ StandardFileProvider::write( const void* buffer, Size size, Size& nout )
 bool
 StandardFileProvider::truncate( Size size )
 {
-    // close the file prior to truncating it
-    _fstream.close();
-
-    // truncate the file using the POSIX truncate function
-    if( ::truncate( _name.c_str(), size ) != 0)
+    if( flush() )
         return true;
-
-    // reopen the file and seek to the new end
-    _fstream.clear();
-    _fstream.open( _name.c_str(), ios::binary | ios::in | ios::out);
-    if ( _fstream.fail() )
+    _readLength = 0;
+    if( ::ftruncate( _fd, size ) != 0 )
         return true;
-
     return seek( size );
 }
 
 bool
 StandardFileProvider::close()
 {
-    _fstream.close();
-    return _fstream.fail();
+    if( _fd < 0 )
+        return false;
+    bool failed = flush();
+    if( _preallocated ) {
+        // give back space reserved beyond the final size
+        struct stat st;
+        if( !failed && ::fstat( _fd, &st ) == 0 && st.st_size < _preallocated )
+            failed = ::ftruncate( _fd, st.st_size ) != 0;
+        _preallocated = 0;
+    }
+    if( ::close( _fd ) != 0 )
+        failed = true;
+    _fd = -1;
+    _readLength = 0;
+    return failed;
 }
 
 bool
 StandardFileProvider::getSize( Size& nout )
 {
-    bool retval;
+    struct stat st;
+    if( ::fstat( _fd, &st ) != 0 )
+        return true;
+    nout = std::max( (Size)st.st_size, _writeStart + _writeLength );
+    return false;
+}
+
+bool
+StandardFileProvider::sync()
+{
+    if( flush() )
+        return true;
+#if defined( __APPLE__ )
+    return ::fsync( _fd ) != 0;
+#else
+    return ::fdatasync( _fd ) != 0;
+#endif
+}
 
-    // getFileSize will log if it fails
-    retval = FileSystem::getFileSize( _name, nout );
+bool
+StandardFileProvider::preallocate( Size size )
+{
+#if defined( FALLOC_FL_KEEP_SIZE )
+    // reserve extents without changing the visible size; unsupported
+    // file systems are not an error, this is only a hint
+    if( ::fallocate( _fd, FALLOC_FL_KEEP_SIZE, 0, size ) != 0 )
+        return errno != EOPNOTSUPP && errno != ENOSYS;
+    _preallocated = std::max( _preallocated, size );
+#endif
+    return false;
+}
 
-    return retval;
+void
+StandardFileProvider::setStreaming( bool enable )
+{
+    _streaming = enable;
+#if defined( POSIX_FADV_SEQUENTIAL )
+    ::posix_fadvise( _fd, 0, 0, enable ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL );
+#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////
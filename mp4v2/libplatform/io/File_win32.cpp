@@ -1,5 +1,6 @@
 #include "src/impl.h"
 #include "libplatform/impl.h" /* for platform_win32_impl.h which declares Utf8ToFilename */
+#include <io.h> // for _commit
 
 #if _WIN32_WINNT < 0x0600
 #   include <io.h> // for _lseeki64 in pre Windows Vista code
@@ -52,6 +53,7 @@ public:
     bool truncate( Size size );
     bool close();
     bool getSize( Size& nout );
+    bool sync();
 
 private:
     FILE* _file;
@@ -256,6 +258,18 @@ StandardFileProvider::getSize( Size& nout )
     return retval;
 }
 
+/**
+ * Commit written data to disk
+ *
+ * @retval false successfully committed the data
+ * @retval true error flushing or committing the data
+ */
+bool
+StandardFileProvider::sync()
+{
+    return fflush( _file ) != 0 || _commit( _fileno( _file )) != 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 FileProvider&
@@ -96,7 +96,7 @@ void MP4RootAtom::FinishWrite()
     // write all atoms after last mdat
     const uint32_t size = m_pChildAtoms.Size();
     for ( uint32_t i = mdatIndex + 1; i < size; i++ )
-        m_pChildAtoms[i]->Write();
+        WriteBuffered( m_pChildAtoms[i] );
 }
 
 void MP4RootAtom::BeginOptimalWrite()
@@ -125,7 +125,16 @@ void MP4RootAtom::BeginOptimalWrite()
     m_File.WriteUInt32(room_size + 8);
     m_File.WriteBytes((uint8_t*)"free", 4);
     uint64_t pos = m_File.GetPosition();
-    m_File.SetPosition(pos + room_size);
+    if (m_File.GetSize() > pos) {
+        // rewriting an existing file; don't leave its old bytes in the room
+        static const uint8_t zeros[4096] = { 0 };
+        for (uint32_t n; room_size > 0; room_size -= n) {
+            n = min(room_size, (uint32_t)sizeof(zeros));
+            m_File.WriteBytes((uint8_t*)zeros, n);
+        }
+    } else {
+        m_File.SetPosition(pos + room_size);
+    }
 
     m_pChildAtoms[GetLastMdatIndex()]->BeginWrite();
 }
@@ -142,7 +151,7 @@ void MP4RootAtom::FinishOptimalWrite()
     m_File.SetPosition(pMoovAtom->GetStart());
     uint64_t oldSize = pMoovAtom->GetSize();
 
-    pMoovAtom->Write();
+    WriteBuffered(pMoovAtom);
     if (pMoovAtom->GetSize() != oldSize)
         WriteAtomType("udta", Many);
 
@@ -172,7 +181,7 @@ void MP4RootAtom::WriteAtomType(const char* type, bool onlyOne)
 
     for (uint32_t i = 0; i < size; i++) {
         if (strequal(type, m_pChildAtoms[i]->GetType())) {
-            m_pChildAtoms[i]->Write();
+            WriteBuffered(m_pChildAtoms[i]);
             if (onlyOne) {
                 break;
             }
@@ -180,6 +189,43 @@ void MP4RootAtom::WriteAtomType(const char* type, bool onlyOne)
     }
 }
 
+/*
+ * Serialize an atom (moov, in practice) into memory and write it to the
+ * file with a single call, instead of one small write per field.
+ */
+void MP4RootAtom::WriteBuffered(MP4Atom* pAtom)
+{
+    if (m_File.IsMemoryBufferEnabled()) {
+        pAtom->Write();
+        return;
+    }
+
+    uint8_t* pBytes = NULL;
+    uint64_t numBytes = 0;
+
+    m_File.EnableMemoryBuffer(NULL, pAtom->GetSize() + 16,
+                              m_File.GetPosition());
+    try {
+        pAtom->Write();
+    }
+    catch (...) {
+        m_File.DisableMemoryBuffer(&pBytes);
+        MP4Free(pBytes);
+        throw;
+    }
+    m_File.DisableMemoryBuffer(&pBytes, &numBytes);
+
+    try {
+        ASSERT(numBytes <= 0xFFFFFFFF);
+        m_File.WriteBytes(pBytes, (uint32_t)numBytes);
+    }
+    catch (...) {
+        MP4Free(pBytes);
+        throw;
+    }
+    MP4Free(pBytes);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 }} // namespace mp4v2::impl
@@ -72,6 +72,7 @@ public:
 protected:
     uint32_t GetLastMdatIndex();
     void WriteAtomType(const char* type, bool onlyOne);
+    void WriteBuffered(MP4Atom* pAtom);
 
 private:
     MP4RootAtom();
@@ -0,0 +1,164 @@
+#include "src/impl.h"
+
+namespace mp4v2 { namespace impl {
+
+///////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const size_t ARENA_ALIGN = 16;
+const size_t ARENA_BLOCK_SIZE = 256 * 1024;
+// anything bigger gets a block of its own, so that big sample tables
+// don't waste the tail of the current block
+const size_t ARENA_LARGE_SIZE = ARENA_BLOCK_SIZE / 4;
+
+// precedes every MP4ArenaMalloc() allocation; 16 bytes keeps the payload
+// aligned the same way malloc() does
+struct AllocHeader {
+    uint64_t size;
+    uint64_t arena;
+};
+
+thread_local MP4Arena* t_currentArena = NULL;
+
+inline size_t AlignSize(size_t size)
+{
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+inline AllocHeader* HeaderOf(void* p)
+{
+    return static_cast<AllocHeader*>(p) - 1;
+}
+
+} // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+
+MP4Arena::MP4Arena()
+    : m_blocks(NULL)
+    , m_size(0)
+{
+}
+
+MP4Arena::~MP4Arena()
+{
+    while (m_blocks) {
+        Block* next = m_blocks->next;
+        free(m_blocks);
+        m_blocks = next;
+    }
+}
+
+void* MP4Arena::Alloc(size_t size)
+{
+    const size_t headerSize = AlignSize(sizeof(Block));
+    size = AlignSize(size);
+
+    if (m_blocks && m_blocks->size - m_blocks->used >= size) {
+        void* p = reinterpret_cast<uint8_t*>(m_blocks) + m_blocks->used;
+        m_blocks->used += size;
+        return p;
+    }
+
+    size_t blockSize = headerSize +
+        (size > ARENA_LARGE_SIZE ? size : ARENA_BLOCK_SIZE);
+
+    Block* block = static_cast<Block*>(malloc(blockSize));
+    if (block == NULL) {
+        throw new PLATFORM_EXCEPTION("malloc failed", errno);
+    }
+    block->size = blockSize;
+    block->used = headerSize + size;
+    m_size += blockSize;
+
+    if (size > ARENA_LARGE_SIZE && m_blocks) {
+        // keep filling the current block
+        block->next = m_blocks->next;
+        m_blocks->next = block;
+    } else {
+        block->next = m_blocks;
+        m_blocks = block;
+    }
+    return reinterpret_cast<uint8_t*>(block) + headerSize;
+}
+
+MP4Arena* MP4Arena::Current()
+{
+    return t_currentArena;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+MP4ArenaScope::MP4ArenaScope(MP4Arena* arena)
+    : m_previous(t_currentArena)
+{
+    t_currentArena = arena;
+}
+
+MP4ArenaScope::~MP4ArenaScope()
+{
+    t_currentArena = m_previous;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void* MP4ArenaMalloc(size_t size)
+{
+    if (size == 0)
+        return NULL;
+
+    AllocHeader* header;
+    if (t_currentArena) {
+        header = static_cast<AllocHeader*>(
+            t_currentArena->Alloc(sizeof(AllocHeader) + size));
+        header->arena = 1;
+    } else {
+        header = static_cast<AllocHeader*>(
+            MP4Malloc(sizeof(AllocHeader) + size));
+        header->arena = 0;
+    }
+    header->size = size;
+    return header + 1;
+}
+
+void* MP4ArenaRealloc(void* p, size_t newSize)
+{
+    if (p == NULL)
+        return MP4ArenaMalloc(newSize);
+    if (newSize == 0) {
+        MP4ArenaFree(p);
+        return NULL;
+    }
+
+    AllocHeader* header = HeaderOf(p);
+    if (!header->arena && !t_currentArena) {
+        header = static_cast<AllocHeader*>(
+            realloc(header, sizeof(AllocHeader) + newSize));
+        if (header == NULL) {
+            throw new PLATFORM_EXCEPTION("malloc failed", errno);
+        }
+        header->size = newSize;
+        return header + 1;
+    }
+
+    // arena memory can't grow in place; an arena block being grown
+    // outside of its scope (editing after Read) moves to the heap
+    void* q = MP4ArenaMalloc(newSize);
+    memcpy(q, p, min(static_cast<uint64_t>(newSize), header->size));
+    MP4ArenaFree(p);
+    return q;
+}
+
+void MP4ArenaFree(void* p)
+{
+    if (p == NULL)
+        return;
+    AllocHeader* header = HeaderOf(p);
+    if (!header->arena)
+        free(header);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+}} // namespace mp4v2::impl
@@ -0,0 +1,81 @@
+#ifndef MP4V2_IMPL_MP4ARENA_H
+#define MP4V2_IMPL_MP4ARENA_H
+
+namespace mp4v2 { namespace impl {
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Monotonic allocator for the atom/property graph of an MP4File.
+ *
+ * Memory is carved out of large blocks and is never returned one object at
+ * a time; everything is released at once when the arena is destroyed.
+ * An arena is not thread safe, each parsing thread gets its own.
+ *
+ * Allocation goes to the arena only while an MP4ArenaScope for it is active
+ * on the calling thread. MP4Atom, MP4Property, MP4Descriptor and MP4Array
+ * storage allocate through MP4ArenaMalloc(), which falls back to the heap
+ * when no arena is current. Every block carries a small header telling
+ * which of the two it came from, so that MP4ArenaFree() can skip arena
+ * memory and MP4ArenaRealloc() can move a table off the arena when it is
+ * grown later on.
+ */
+class MP4Arena {
+public:
+    MP4Arena();
+    ~MP4Arena();
+
+    void* Alloc(size_t size);
+
+    uint64_t GetSize() const {
+        return m_size;
+    }
+
+    static MP4Arena* Current();
+
+private:
+    struct Block {
+        Block*  next;
+        size_t  size;
+        size_t  used;
+    };
+
+    Block*      m_blocks;
+    uint64_t    m_size;
+
+private:
+    MP4Arena( const MP4Arena &src );
+    MP4Arena &operator= ( const MP4Arena &src );
+};
+
+/**
+ * Makes an arena current on the calling thread for the lifetime of the
+ * scope. Scopes nest; NULL makes allocations go to the heap again.
+ */
+class MP4ArenaScope {
+public:
+    explicit MP4ArenaScope(MP4Arena* arena);
+    ~MP4ArenaScope();
+
+private:
+    MP4Arena* m_previous;
+
+private:
+    MP4ArenaScope( const MP4ArenaScope &src );
+    MP4ArenaScope &operator= ( const MP4ArenaScope &src );
+};
+
+void* MP4ArenaMalloc(size_t size);
+void* MP4ArenaRealloc(void* p, size_t newSize);
+void MP4ArenaFree(void* p);
+
+/// class-level operator new/delete routing objects through the arena
+#define MP4_ARENA_ALLOCATED \
+    static void* operator new(size_t size) { return MP4ArenaMalloc(size); } \
+    static void operator delete(void* p) { MP4ArenaFree(p); }
+
+///////////////////////////////////////////////////////////////////////////////
+
+}} // namespace mp4v2::impl
+
+#endif // MP4V2_IMPL_MP4ARENA_H
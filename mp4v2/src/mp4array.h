@@ -38,7 +38,7 @@ public:
     }
 
     ~MP4Array() {
-        MP4Free(m_elements);
+        MP4ArenaFree(m_elements);
     }
 
     inline bool ValidIndex(MP4ArrayIndex index) {
@@ -63,7 +63,7 @@ public:
         }
         if (m_numElements == m_maxNumElements) {
             MP4ArrayIndex newSize = max(m_maxNumElements, (MP4ArrayIndex)1) * 2;
-            m_elements = (type*)MP4Realloc(m_elements,
+            m_elements = (type*)MP4ArenaRealloc(m_elements,
                 newSize * sizeof(type));
             m_maxNumElements = newSize;
         }
@@ -89,7 +89,7 @@ public:
     void Resize(MP4ArrayIndex newSize) {
         if ( (uint64_t) newSize * sizeof(type) > 0xFFFFFFFF )
             throw new PLATFORM_EXCEPTION("requested array size exceeds 4GB", ERANGE); /* prevent overflow */
-        m_elements = (type*)MP4Realloc(m_elements,
+        m_elements = (type*)MP4ArenaRealloc(m_elements,
         newSize * sizeof(type));
         m_numElements = newSize;
         m_maxNumElements = newSize;
@@ -197,15 +197,42 @@ MP4Atom* MP4Atom::ReadAtom(MP4File& file, MP4Atom* pParentAtom)
 
     pAtom->SetParentAtom(pParentAtom);
 
+    // A top-level moov is fetched with one read and parsed from memory,
+    // instead of issuing a seek and a small read for every property.
+    uint8_t* pMoovData = NULL;
+    if (ATOMID(type) == ATOMID("moov") && !pParentAtom->GetParentAtom()
+            && !file.IsMemoryBufferEnabled()
+            && dataSize > 0 && dataSize <= 0xFFFFFFFF) {
+        pMoovData = (uint8_t*)MP4Malloc(dataSize);
+        try {
+            file.ReadBytes(pMoovData, (uint32_t)dataSize);
+        }
+        catch (Exception*) {
+            MP4Free(pMoovData);
+            delete pAtom;
+            throw;
+        }
+        file.EnableMemoryBuffer(pMoovData, dataSize, pos + hdrSize);
+    }
+
     try {
         pAtom->Read();
     }
     catch (Exception*) {
+        if (pMoovData) {
+            file.DisableMemoryBuffer();
+            MP4Free(pMoovData);
+        }
         // delete atom and rethrow so we don't leak memory.
         delete pAtom;
         throw;
     }
 
+    if (pMoovData) {
+        file.DisableMemoryBuffer();
+        MP4Free(pMoovData);
+    }
+
     return pAtom;
 }
 
@@ -402,9 +429,36 @@ void MP4Atom::ReadProperties(uint32_t startIndex, uint32_t count)
     }
 }
 
+void MP4Atom::CountChildAtom(MP4Atom* pChildAtom)
+{
+    MP4AtomInfo* pChildAtomInfo = FindAtomInfo(pChildAtom->GetType());
+
+    // if child atom is of known type
+    // but not expected here print warning
+    if (pChildAtomInfo == NULL && !pChildAtom->IsUnknownType()) {
+        log.verbose1f("%s: \"%s\": In atom %s unexpected child atom %s", __FUNCTION__,
+                      m_File.GetFilename().c_str(), GetType(), pChildAtom->GetType());
+    }
+
+    // if child atoms should have just one instance
+    // and this is more than one, print warning
+    if (pChildAtomInfo) {
+        pChildAtomInfo->m_count++;
+
+        if (pChildAtomInfo->m_onlyOne && pChildAtomInfo->m_count > 1) {
+            log.warningf("%s: \"%s\": In atom %s multiple child atoms %s", __FUNCTION__,
+                         m_File.GetFilename().c_str(), GetType(), pChildAtom->GetType());
+        }
+    }
+}
+
 void MP4Atom::ReadChildAtoms()
 {
     bool this_is_udta = ATOMID(m_type) == ATOMID("udta");
+    bool parallelTraks = ATOMID(m_type) == ATOMID("moov")
+        && m_File.GetParseThreads() > 1 && m_File.IsMemoryBufferEnabled();
+    MP4Integer64Array trakPositions;
+    MP4Integer32Array trakIndices;
 
     log.verbose1f("\"%s\": of %s", m_File.GetFilename().c_str(), m_type[0] ? m_type : "root");
     for (uint64_t position = m_File.GetPosition();
@@ -431,30 +485,42 @@ void MP4Atom::ReadChildAtoms()
             }
             continue;
         }
+        // trak subtrees of an in-memory moov are independent of each other;
+        // only note where they are, and parse them together below
+        if (parallelTraks && m_end - position >= 8) {
+            uint32_t size = m_File.ReadUInt32();
+            char type[5] = {0};
+            m_File.ReadBytes((uint8_t*)type, 4);
+            if (ATOMID(type) == ATOMID("trak")
+                    && size >= 8 && size <= m_end - position) {
+                trakPositions.Add(position);
+                trakIndices.Add(m_pChildAtoms.Size() + trakPositions.Size() - 1);
+                m_File.SetPosition(position + size);
+                continue;
+            }
+            m_File.SetPosition(position);
+        }
+
         MP4Atom* pChildAtom = MP4Atom::ReadAtom(m_File, this);
 
         AddChildAtom(pChildAtom);
 
-        MP4AtomInfo* pChildAtomInfo = FindAtomInfo(pChildAtom->GetType());
+        CountChildAtom(pChildAtom);
+    }
 
-        // if child atom is of known type
-        // but not expected here print warning
-        if (pChildAtomInfo == NULL && !pChildAtom->IsUnknownType()) {
-            log.verbose1f("%s: \"%s\": In atom %s unexpected child atom %s", __FUNCTION__,
-                          m_File.GetFilename().c_str(), GetType(), pChildAtom->GetType());
+    if (trakPositions.Size()) {
+        MP4AtomArray traks;
+        try {
+            m_File.ReadAtomsParallel(this, trakPositions, traks);
         }
-
-        // if child atoms should have just one instance
-        // and this is more than one, print warning
-        if (pChildAtomInfo) {
-            pChildAtomInfo->m_count++;
-
-            if (pChildAtomInfo->m_onlyOne && pChildAtomInfo->m_count > 1) {
-                log.warningf("%s: \"%s\": In atom %s multiple child atoms %s", __FUNCTION__,
-                             m_File.GetFilename().c_str(), GetType(), pChildAtom->GetType());
-            }
+        catch (Exception*) {
+            m_File.SetPosition(m_end);
+            throw;
+        }
+        for (uint32_t i = 0; i < traks.Size(); i++) {
+            InsertChildAtom(traks[i], trakIndices[i]);
+            CountChildAtom(traks[i]);
         }
-
     }
 
     // if mandatory child atom doesn't exist, print warning
@@ -64,6 +64,8 @@ typedef MP4Array<MP4AtomInfo*> MP4AtomInfoArray;
 class MP4Atom
 {
 public:
+    MP4_ARENA_ALLOCATED
+
     static MP4Atom* ReadAtom( MP4File& file, MP4Atom* pParentAtom );
     static MP4Atom* CreateAtom( MP4File& file, MP4Atom* parent, const char* type );
     static bool IsReasonableType( const char* type );
@@ -218,6 +220,7 @@ protected:
     void ReadProperties(
         uint32_t startIndex = 0, uint32_t count = 0xFFFFFFFF);
     void ReadChildAtoms();
+    void CountChildAtom(MP4Atom* pChildAtom);
 
     void WriteProperties(
         uint32_t startIndex = 0, uint32_t count = 0xFFFFFFFF);
@@ -29,6 +29,8 @@ namespace impl {
 
 class MP4Descriptor {
 public:
+    MP4_ARENA_ALLOCATED
+
     MP4Descriptor(MP4Atom& parentAtom, uint8_t tag = 0);
 
     virtual ~MP4Descriptor();
@@ -64,6 +64,8 @@ void MP4File::Init()
     m_memoryBuffer = NULL;
     m_memoryBufferSize = 0;
     m_memoryBufferPosition = 0;
+    m_memoryBufferBase = 0;
+    m_parseThreads = 1;
 
     m_numReadBits = 0;
     m_bufReadBits = 0;
@@ -81,6 +83,22 @@ MP4File::~MP4File()
         delete m_pTracks[i];
     MP4Free( m_memoryBuffer ); // just in case
     delete m_file;
+    // after the tree: atoms and properties read from the file live here
+    for( size_t i = 0; i < m_arenas.size(); i++ )
+        delete m_arenas[i];
+}
+
+MP4Arena* MP4File::NewArena()
+{
+    MP4Arena* arena = new MP4Arena();
+    try {
+        m_arenas.push_back( arena );
+    }
+    catch( ... ) {
+        delete arena;
+        throw;
+    }
+    return arena;
 }
 
 const std::string &
@@ -417,17 +435,23 @@ void MP4File::ReadFromFile()
     // ensure we start at beginning of file
     SetPosition(0);
 
-    // create a new root atom
-    ASSERT(m_pRootAtom == NULL);
-    m_pRootAtom = MP4Atom::CreateAtom(*this, NULL, NULL);
+    {
+        // the atom tree lives until the file is closed; allocate it in
+        // bulk and release it all at once in the destructor
+        MP4ArenaScope arenaScope(NewArena());
 
-    uint64_t fileSize = GetSize();
+        // create a new root atom
+        ASSERT(m_pRootAtom == NULL);
+        m_pRootAtom = MP4Atom::CreateAtom(*this, NULL, NULL);
 
-    m_pRootAtom->SetStart(0);
-    m_pRootAtom->SetSize(fileSize);
-    m_pRootAtom->SetEnd(fileSize);
+        uint64_t fileSize = GetSize();
 
-    m_pRootAtom->Read();
+        m_pRootAtom->SetStart(0);
+        m_pRootAtom->SetSize(fileSize);
+        m_pRootAtom->SetEnd(fileSize);
+
+        m_pRootAtom->Read();
+    }
 
     // create MP4Track's for any tracks in the file
     GenerateTracks();
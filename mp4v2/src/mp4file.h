@@ -828,10 +828,30 @@ public:
     void FlushWriteBits();
     void WriteMpegLength(uint32_t value, bool compact = false);
 
+    // basePosition: file position that the first byte of pBytes maps to,
+    // so that positions seen through the buffer stay absolute
     void EnableMemoryBuffer(
-        uint8_t* pBytes = NULL, uint64_t numBytes = 0);
+        uint8_t* pBytes = NULL, uint64_t numBytes = 0,
+        uint64_t basePosition = 0);
     void DisableMemoryBuffer(
         uint8_t** ppBytes = NULL, uint64_t* pNumBytes = NULL);
+    bool IsMemoryBufferEnabled() { return m_memoryBuffer != NULL; }
+
+    // Number of threads used to parse the trak subtrees of a moov that
+    // is held in the memory buffer; 1 (the default) parses serially.
+    void SetParseThreads(uint32_t numThreads) {
+        m_parseThreads = numThreads ? numThreads : 1;
+    }
+    uint32_t GetParseThreads() { return m_parseThreads; }
+
+    // Reads one child atom of pParentAtom from each of the given
+    // positions in the memory buffer, on up to GetParseThreads() threads,
+    // each with its own read cursor. ppAtoms receives them in order.
+    void ReadAtomsParallel(MP4Atom* pParentAtom,
+                           MP4Integer64Array& positions,
+                           MP4Array<MP4Atom*>& ppAtoms);
+
+    MP4Arena* NewArena();
 
     bool IsWriteMode();
 
@@ -997,6 +1017,12 @@ protected:
     uint8_t*    m_memoryBuffer;
     uint64_t    m_memoryBufferPosition;
     uint64_t    m_memoryBufferSize;
+    uint64_t    m_memoryBufferBase;
+    uint32_t    m_parseThreads;
+
+    // arenas holding the atom tree read from the file, one per parsing
+    // thread; released after the tree is deleted
+    std::vector<MP4Arena*> m_arenas;
 
     // bit read/write buffering
     uint8_t m_numReadBits;
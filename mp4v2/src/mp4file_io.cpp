@@ -20,18 +20,50 @@
  */
 
 #include "src/impl.h"
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <system_error>
 
 namespace mp4v2 {
 namespace impl {
 
 ///////////////////////////////////////////////////////////////////////////////
 
+namespace {
+
+// Read state private to a parser thread (see ReadAtomsParallel).
+// While installed for a file, reads from that file's memory buffer use it
+// instead of the shared m_memoryBufferPosition and read-bit state.
+struct ThreadReadCursor {
+    const MP4File* file;
+    uint64_t       position;
+    uint8_t        numReadBits;
+    uint8_t        bufReadBits;
+};
+
+thread_local ThreadReadCursor* t_readCursor = NULL;
+
+inline ThreadReadCursor* ReadCursorFor( const MP4File* file )
+{
+    ThreadReadCursor* cursor = t_readCursor;
+    return cursor && cursor->file == file ? cursor : NULL;
+}
+
+} // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+
 // MP4File low level IO support
 
 uint64_t MP4File::GetPosition( File* file )
 {
-    if( m_memoryBuffer )
-        return m_memoryBufferPosition;
+    if( m_memoryBuffer ) {
+        ThreadReadCursor* cursor = ReadCursorFor( this );
+        return m_memoryBufferBase
+            + (cursor ? cursor->position : m_memoryBufferPosition);
+    }
 
     if( !file )
         file = m_file;
@@ -43,9 +75,12 @@ uint64_t MP4File::GetPosition( File* file )
 void MP4File::SetPosition( uint64_t pos, File* file )
 {
     if( m_memoryBuffer ) {
-        if( pos >= m_memoryBufferSize )
+        if( pos < m_memoryBufferBase
+                || pos - m_memoryBufferBase > m_memoryBufferSize )
             throw new EXCEPTION("position out of range");
-        m_memoryBufferPosition = pos;
+        ThreadReadCursor* cursor = ReadCursorFor( this );
+        (cursor ? cursor->position : m_memoryBufferPosition)
+            = pos - m_memoryBufferBase;
         return;
     }
 
@@ -60,7 +95,7 @@ void MP4File::SetPosition( uint64_t pos, File* file )
 uint64_t MP4File::GetSize( File* file )
 {
     if( m_memoryBuffer )
-        return m_memoryBufferSize;
+        return m_memoryBufferBase + m_memoryBufferSize;
 
     if( !file )
         file = m_file;
@@ -75,15 +110,17 @@ void MP4File::ReadBytes( uint8_t* buf, uint32_t bufsiz, File* file )
         return;
 
     ASSERT( buf );
-    if ( m_numReadBits > 0 ) {
+    ThreadReadCursor* cursor = ReadCursorFor( this );
+    if ( (cursor ? cursor->numReadBits : m_numReadBits) > 0 ) {
         WARNING( m_numReadBits > 0 );
     }
 
     if( m_memoryBuffer ) {
-        if( m_memoryBufferPosition + bufsiz > m_memoryBufferSize )
+        uint64_t& position = cursor ? cursor->position : m_memoryBufferPosition;
+        if( position + bufsiz > m_memoryBufferSize )
             throw new EXCEPTION("not enough bytes, reached end-of-memory");
-        memcpy( buf, &m_memoryBuffer[m_memoryBufferPosition], bufsiz );
-        m_memoryBufferPosition += bufsiz;
+        memcpy( buf, &m_memoryBuffer[position], bufsiz );
+        position += bufsiz;
         return;
     }
 
@@ -105,7 +142,7 @@ void MP4File::PeekBytes( uint8_t* buf, uint32_t bufsiz, File* file )
     SetPosition( pos, file );
 }
 
-void MP4File::EnableMemoryBuffer( uint8_t* pBytes, uint64_t numBytes )
+void MP4File::EnableMemoryBuffer( uint8_t* pBytes, uint64_t numBytes, uint64_t basePosition )
 {
     ASSERT( !m_memoryBuffer );
 
@@ -121,6 +158,7 @@ void MP4File::EnableMemoryBuffer( uint8_t* pBytes, uint64_t numBytes )
         m_memoryBuffer = (uint8_t*)MP4Malloc(m_memoryBufferSize);
     }
     m_memoryBufferPosition = 0;
+    m_memoryBufferBase = basePosition;
 }
 
 void MP4File::DisableMemoryBuffer( uint8_t** ppBytes, uint64_t* pNumBytes )
@@ -137,6 +175,7 @@ void MP4File::DisableMemoryBuffer( uint8_t** ppBytes, uint64_t* pNumBytes )
     m_memoryBuffer = NULL;
     m_memoryBufferSize = 0;
     m_memoryBufferPosition = 0;
+    m_memoryBufferBase = 0;
 }
 
 void MP4File::WriteBytes( uint8_t* buf, uint32_t bufsiz, File* file )
@@ -481,13 +520,16 @@ uint64_t MP4File::ReadBits(uint8_t numBits)
     ASSERT(numBits <= 64);
 
     uint64_t bits = 0;
+    ThreadReadCursor* cursor = ReadCursorFor(this);
+    uint8_t& numReadBits = cursor ? cursor->numReadBits : m_numReadBits;
+    uint8_t& bufReadBits = cursor ? cursor->bufReadBits : m_bufReadBits;
 
     for (uint8_t i = numBits; i > 0; i--) {
-        if (m_numReadBits == 0) {
-            ReadBytes(&m_bufReadBits, 1);
-            m_numReadBits = 8;
+        if (numReadBits == 0) {
+            ReadBytes(&bufReadBits, 1);
+            numReadBits = 8;
         }
-        bits = (bits << 1) | ((m_bufReadBits >> (--m_numReadBits)) & 1);
+        bits = (bits << 1) | ((bufReadBits >> (--numReadBits)) & 1);
     }
 
     return bits;
@@ -496,7 +538,8 @@ uint64_t MP4File::ReadBits(uint8_t numBits)
 void MP4File::FlushReadBits()
 {
     // eat any remaining bits in the read buffer
-    m_numReadBits = 0;
+    ThreadReadCursor* cursor = ReadCursorFor(this);
+    (cursor ? cursor->numReadBits : m_numReadBits) = 0;
 }
 
 void MP4File::WriteBits(uint64_t bits, uint8_t numBits)
@@ -581,5 +624,97 @@ void MP4File::WriteMpegLength(uint32_t value, bool compact)
 
 ///////////////////////////////////////////////////////////////////////////////
 
+///////////////////////////////////////////////////////////////////////////////
+
+void MP4File::ReadAtomsParallel( MP4Atom*           pParentAtom,
+                                 MP4Integer64Array& positions,
+                                 MP4AtomArray&      ppAtoms )
+{
+    ASSERT( m_memoryBuffer );
+
+    const uint32_t numAtoms = positions.Size();
+    ppAtoms.Resize( numAtoms );
+    for( uint32_t i = 0; i < numAtoms; i++ )
+        ppAtoms[i] = NULL;
+
+    std::atomic<uint32_t> next( 0 );
+    std::atomic<bool> failed( false );
+    Exception* error = NULL;
+    std::exception_ptr otherError;
+    uint32_t errorIndex = numAtoms;
+    std::mutex errorLock;
+
+    // each thread allocates from an arena of its own; arenas are created
+    // here, since the array holding them isn't thread safe
+    const uint32_t numThreads = std::min( m_parseThreads, numAtoms );
+    std::vector<MP4Arena*> arenas( numThreads, MP4Arena::Current() );
+    if( MP4Arena::Current() ) {
+        for( uint32_t i = 1; i < numThreads; i++ )
+            arenas[i] = NewArena();
+    }
+
+    auto worker = [&]( MP4Arena* arena ) {
+        MP4ArenaScope arenaScope( arena );
+        ThreadReadCursor cursor = { this, 0, 0, 0 };
+        ThreadReadCursor* saved = t_readCursor;
+        t_readCursor = &cursor;
+        for( uint32_t i; !failed && (i = next++) < numAtoms; ) {
+            try {
+                cursor.position = positions[i] - m_memoryBufferBase;
+                cursor.numReadBits = 0;
+                ppAtoms[i] = MP4Atom::ReadAtom( *this, pParentAtom );
+            }
+            catch( Exception* x ) {
+                // keep the error of the first atom in file order
+                std::lock_guard<std::mutex> lock( errorLock );
+                if( i < errorIndex ) {
+                    delete error;
+                    error = x;
+                    otherError = std::exception_ptr();
+                    errorIndex = i;
+                } else {
+                    delete x;
+                }
+                failed = true;
+            }
+            catch( ... ) {
+                // anything else (bad_alloc...) mustn't leave the thread
+                std::lock_guard<std::mutex> lock( errorLock );
+                if( i < errorIndex ) {
+                    delete error;
+                    error = NULL;
+                    otherError = std::current_exception();
+                    errorIndex = i;
+                }
+                failed = true;
+            }
+        }
+        t_readCursor = saved;
+    };
+
+    std::vector<std::thread> threads;
+    for( uint32_t i = 1; i < numThreads; i++ ) {
+        try {
+            threads.push_back( std::thread( worker, arenas[i] ));
+        }
+        catch( std::system_error& ) {
+            // no more threads available; the rest is parsed by those we have
+            break;
+        }
+    }
+    worker( arenas[0] );
+    for( size_t i = 0; i < threads.size(); i++ )
+        threads[i].join();
+
+    if( error || otherError ) {
+        for( uint32_t i = 0; i < numAtoms; i++ )
+            delete ppAtoms[i];
+        ppAtoms.Resize( 0 );
+        if( otherError )
+            std::rethrow_exception( otherError );
+        throw error;
+    }
+}
+
 }
 } // namespace mp4v2::impl
@@ -850,11 +850,64 @@ void MP4TableProperty::Write(MP4File& file, uint32_t index)
         ASSERT(m_pProperties[0]->GetCount() == numEntries);
     }
 
+    if (WriteIntegerTable(file, numEntries)) {
+        return;
+    }
+
     for (uint32_t i = 0; i < numEntries; i++) {
         WriteEntry(file, i);
     }
 }
 
+/*
+ * Tables made only of plain integer columns (stco, co64, stsz, stts, ctts,
+ * stsc, stss...) are encoded a block of rows at a time into a big-endian
+ * buffer and handed to the file with one WriteBytes() per block, rather
+ * than one per field.
+ */
+bool MP4TableProperty::WriteIntegerTable(MP4File& file, uint32_t numEntries)
+{
+    const uint32_t numProperties = m_pProperties.Size();
+    uint32_t rowSize = 0;
+
+    for (uint32_t j = 0; j < numProperties; j++) {
+        switch (m_pProperties[j]->GetType()) {
+        case Integer8Property:
+        case Integer16Property:
+        case Integer24Property:
+        case Integer32Property:
+        case Integer64Property:
+        case Integer6432Property:
+            break;
+        default:
+            return false;
+        }
+        MP4IntegerProperty* pProperty =
+            (MP4IntegerProperty*)m_pProperties[j];
+        uint32_t size = pProperty->GetEncodedSize();
+        if (size == 0 || pProperty->GetCount() < numEntries) {
+            return false;
+        }
+        rowSize += size;
+    }
+
+    const uint32_t blockRows = max((uint32_t)1, (uint32_t)((1 << 20) / rowSize));
+    std::vector<uint8_t> block((size_t)min(blockRows, numEntries) * rowSize);
+
+    for (uint32_t i = 0; i < numEntries; i += blockRows) {
+        uint32_t rows = min(blockRows, numEntries - i);
+        uint32_t offset = 0;
+        for (uint32_t j = 0; j < numProperties; j++) {
+            MP4IntegerProperty* pProperty =
+                (MP4IntegerProperty*)m_pProperties[j];
+            pProperty->EncodeValues(&block[offset], rowSize, i, rows);
+            offset += pProperty->GetEncodedSize();
+        }
+        file.WriteBytes(&block[0], rows * rowSize);
+    }
+    return true;
+}
+
 void MP4TableProperty::WriteEntry(MP4File& file, uint32_t index)
 {
     for (uint32_t j = 0; j < m_pProperties.Size(); j++) {
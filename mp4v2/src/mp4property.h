@@ -51,6 +51,8 @@ enum MP4PropertyType {
 
 class MP4Property {
 public:
+    MP4_ARENA_ALLOCATED
+
     MP4Property(MP4Atom& parentAtom, const char *name = NULL);
 
     virtual ~MP4Property() { }
@@ -124,6 +126,17 @@ public:
 
     void IncrementValue(int32_t increment = 1, uint32_t index = 0);
 
+    // Bytes per value when the values are stored as plain big-endian
+    // integers, 0 when they need Write(). Lets tables be written in bulk.
+    virtual uint32_t GetEncodedSize() {
+        return 0;
+    }
+    // Encode count values from startIndex, one every stride bytes
+    virtual void EncodeValues(uint8_t* /*pBytes*/, uint32_t /*stride*/,
+                              uint32_t /*startIndex*/, uint32_t /*count*/) {
+        ASSERT(false);
+    }
+
 private:
     MP4IntegerProperty();
     MP4IntegerProperty ( const MP4IntegerProperty &src );
@@ -200,6 +213,22 @@ public:
         file.WriteUInt<type, size>(m_values[index]);
     }
 
+    uint32_t GetEncodedSize() {
+        return m_implicit ? 0 : size / 8;
+    }
+
+    void EncodeValues(uint8_t* pBytes, uint32_t stride,
+                      uint32_t startIndex, uint32_t count) {
+        if (count == 0) {
+            return;
+        }
+        if (startIndex + count > m_values.Size()) {
+            throw new PLATFORM_EXCEPTION("illegal array index", ERANGE);
+        }
+        MP4EncodeBigEndian(pBytes, stride, &m_values[startIndex], count,
+                           size / 8);
+    }
+
     void Dump(uint8_t indent,
         bool dumpImplicits, uint32_t index = 0);
 
@@ -249,6 +278,9 @@ public:
         else
             file.WriteUInt32(m_values[index]);
     }
+    uint32_t GetEncodedSize() {
+        return m_is64bit ? MP4Integer64Property::GetEncodedSize() : 0;
+    }
 private:
     bool m_is64bit;
 };
@@ -268,6 +300,9 @@ public:
     void SetNumBits(uint8_t numBits) {
         m_numBits = numBits;
     }
+    uint32_t GetEncodedSize() {
+        return 0;
+    }
 
     void Read(MP4File& file, uint32_t index = 0);
     void Write(MP4File& file, uint32_t index = 0);
@@ -607,6 +642,8 @@ protected:
     virtual void ReadEntry(MP4File& file, uint32_t index);
     virtual void WriteEntry(MP4File& file, uint32_t index);
 
+    bool WriteIntegerTable(MP4File& file, uint32_t numEntries);
+
     bool FindContainedProperty(const char* name,
                                MP4Property** ppProperty, uint32_t* pIndex);
 
@@ -22,6 +22,11 @@
 
 #include "src/impl.h"
 
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#   define MP4V2_HAVE_SSE2 1
+#   include <emmintrin.h>
+#endif
+
 namespace mp4v2 { namespace impl {
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -276,6 +281,96 @@ MP4Timestamp MP4GetAbsTimestamp() {
 
 ///////////////////////////////////////////////////////////////////////////////
 
+namespace {
+
+template <class type>
+inline void EncodeBigEndianScalar(uint8_t* pDst, uint32_t stride,
+                                  const type* pSrc, uint32_t count,
+                                  uint32_t size)
+{
+    for (uint32_t i = 0; i < count; i++, pDst += stride) {
+        type value = pSrc[i];
+        for (uint32_t j = size; j > 0; j--) {
+            pDst[j - 1] = (uint8_t)value;
+            value >>= 8;
+        }
+    }
+}
+
+#if defined( MP4V2_HAVE_SSE2 )
+// swap the bytes of each 16-bit lane; word order is fixed up by the caller
+inline __m128i SwapBytes16(__m128i v)
+{
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+#endif
+
+} // namespace
+
+void MP4EncodeBigEndian(uint8_t* pDst, uint32_t stride,
+                        const uint8_t* pSrc, uint32_t count, uint32_t size)
+{
+    ASSERT(size == 1);
+    if (stride == 1) {
+        memcpy(pDst, pSrc, count);
+        return;
+    }
+    EncodeBigEndianScalar(pDst, stride, pSrc, count, size);
+}
+
+void MP4EncodeBigEndian(uint8_t* pDst, uint32_t stride,
+                        const uint16_t* pSrc, uint32_t count, uint32_t size)
+{
+    ASSERT(size == 2);
+    EncodeBigEndianScalar(pDst, stride, pSrc, count, size);
+}
+
+void MP4EncodeBigEndian(uint8_t* pDst, uint32_t stride,
+                        const uint32_t* pSrc, uint32_t count, uint32_t size)
+{
+    ASSERT(size == 3 || size == 4);
+#if defined( MP4V2_HAVE_SSE2 )
+    if (size == 4 && stride == 4) {
+        uint32_t n = count & ~3U;
+        for (uint32_t i = 0; i < n; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(pSrc + i));
+            v = SwapBytes16(v);
+            v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+            v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+            _mm_storeu_si128((__m128i*)(pDst + i * 4), v);
+        }
+        pDst += n * 4;
+        pSrc += n;
+        count -= n;
+    }
+#endif
+    EncodeBigEndianScalar(pDst, stride, pSrc, count, size);
+}
+
+void MP4EncodeBigEndian(uint8_t* pDst, uint32_t stride,
+                        const uint64_t* pSrc, uint32_t count, uint32_t size)
+{
+    ASSERT(size == 8);
+#if defined( MP4V2_HAVE_SSE2 )
+    if (stride == 8) {
+        uint32_t n = count & ~1U;
+        for (uint32_t i = 0; i < n; i += 2) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(pSrc + i));
+            v = SwapBytes16(v);
+            v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+            v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+            _mm_storeu_si128((__m128i*)(pDst + i * 8), v);
+        }
+        pDst += n * 8;
+        pSrc += n;
+        count -= n;
+    }
+#endif
+    EncodeBigEndianScalar(pDst, stride, pSrc, count, size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
 uint32_t STRTOINT32( const char* s )
 {
 #if defined( MP4V2_INTSTRING_ALIGNMENT )
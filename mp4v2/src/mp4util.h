@@ -113,6 +113,17 @@ char* MP4ToBase64(const uint8_t* pData, uint32_t dataSize);
 
 const char* MP4NormalizeTrackType(const char* type);
 
+// Store count values in big-endian order, size bytes each, one value every
+// stride bytes starting at pDst. Used to serialize whole integer tables.
+void MP4EncodeBigEndian(uint8_t* pDst, uint32_t stride,
+                        const uint8_t* pSrc, uint32_t count, uint32_t size);
+void MP4EncodeBigEndian(uint8_t* pDst, uint32_t stride,
+                        const uint16_t* pSrc, uint32_t count, uint32_t size);
+void MP4EncodeBigEndian(uint8_t* pDst, uint32_t stride,
+                        const uint32_t* pSrc, uint32_t count, uint32_t size);
+void MP4EncodeBigEndian(uint8_t* pDst, uint32_t stride,
+                        const uint64_t* pSrc, uint32_t count, uint32_t size);
+
 ///////////////////////////////////////////////////////////////////////////////
 
 }} // namespace mp4v2::impl
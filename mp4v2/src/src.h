@@ -26,6 +26,7 @@ namespace mp4v2 { namespace impl {
 #include "util.h"
 #include "log.h"
 #include "mp4util.h"
+#include "mp4arena.h"
 #include "mp4array.h"
 #include "mp4track.h"
 #include "mp4file.h"
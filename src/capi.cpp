@@ -0,0 +1,272 @@
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include "mp4fpsmod.h"
+#include "mp4filex.h"
+#include "mp4v2wrapper.h"
+#include "retime.h"
+
+const char *getversion();
+
+struct mp4fpsmod {
+    Option opt;
+    mp4v2::impl::MP4File *file;
+    MP4IOCallbacks srcCallbacks;
+    MP4TrackId trackId;
+    SampleTable table;
+    bool done;
+    std::string error;
+
+    mp4fpsmod(): file(0), trackId(MP4_INVALID_TRACK_ID), done(false)
+    {
+        opt.verbose = false;
+    }
+    ~mp4fpsmod() { delete file; }
+};
+
+namespace {
+
+/*
+ * Runs f, turning what it throws into -1 and the message of
+ * mp4fpsmod_error(); nothing may propagate into C callers.
+ */
+template <typename F>
+int guard(mp4fpsmod *h, F f)
+{
+    try {
+        f();
+        return 0;
+    } catch (mp4v2::impl::Exception *e) {
+        h->error = format_mp4error(*e);
+        delete e;
+    } catch (const std::exception &e) {
+        h->error = e.what();
+    } catch (...) {
+        h->error = "unknown error";
+    }
+    return -1;
+}
+
+void copyCallbacks(MP4IOCallbacks *dst, const mp4fpsmod_io *io)
+{
+    dst->size = io->size;
+    dst->seek = io->seek;
+    dst->read = io->read;
+    dst->write = io->write;
+    dst->truncate = io->truncate;
+}
+
+/* the edits are applied to the file as it was read, only once */
+void checkEditable(mp4fpsmod *h)
+{
+    if (!h->file)
+        throw std::runtime_error("no file is open");
+    if (h->done)
+        throw std::runtime_error("the file has already been written");
+}
+
+}
+
+extern "C" {
+
+const char *mp4fpsmod_version(void)
+{
+    return getversion();
+}
+
+mp4fpsmod *mp4fpsmod_create(void)
+{
+    try {
+        mp4v2::impl::log.setVerbosity(MP4_LOG_NONE);
+        return new mp4fpsmod();
+    } catch (...) {
+        return 0;
+    }
+}
+
+void mp4fpsmod_destroy(mp4fpsmod *h)
+{
+    delete h;
+}
+
+const char *mp4fpsmod_error(const mp4fpsmod *h)
+{
+    return h->error.c_str();
+}
+
+int mp4fpsmod_open(mp4fpsmod *h, const char *path, const mp4fpsmod_io *io,
+                   void *handle, int mode)
+{
+    return guard(h, [&]() {
+        if (h->file)
+            throw std::runtime_error("a file is already open");
+        if (!io && !path)
+            throw std::runtime_error("neither path nor io is given");
+        if (mode != MP4FPSMOD_READ && mode != MP4FPSMOD_MODIFY)
+            throw std::runtime_error("invalid mode");
+        const MP4IOCallbacks *callbacks = 0;
+        if (io) {
+            copyCallbacks(&h->srcCallbacks, io);
+            callbacks = &h->srcCallbacks;
+        }
+        h->opt.inplace = mode == MP4FPSMOD_MODIFY;
+        h->opt.srcCallbacks = callbacks;
+        h->opt.srcHandle = handle;
+
+        mp4v2::impl::MP4File *file = new mp4v2::impl::MP4File;
+        try {
+            if (h->opt.inplace)
+                file->Modify(path, callbacks, handle);
+            else
+                file->Read(path, 0, callbacks, handle);
+            h->trackId = file->FindTrackId(0, MP4_VIDEO_TRACK_TYPE);
+            MP4TrackX *track =
+                reinterpret_cast<MP4TrackX*>(file->GetTrack(h->trackId));
+            TrackEditor(track).SaveTable(&h->table);
+        } catch (...) {
+            delete file;
+            throw;
+        }
+        h->file = file;
+    });
+}
+
+size_t mp4fpsmod_frame_count(const mp4fpsmod *h)
+{
+    return h->table.times.empty() ? 0 : h->table.times.size() - 1;
+}
+
+uint32_t mp4fpsmod_timescale(const mp4fpsmod *h)
+{
+    return h->table.timeScale;
+}
+
+int mp4fpsmod_get_timecodes(mp4fpsmod *h, double *ms, size_t count)
+{
+    return guard(h, [&]() {
+        checkEditable(h);
+        size_t frames = mp4fpsmod_frame_count(h);
+        if (count < frames)
+            throw std::runtime_error("the buffer is smaller than the "
+                                     "number of frames");
+        const SampleTable &table = h->table;
+        if (!frames)
+            return;
+        uint64_t off = table.times[table.ctsIndex[0]].cts;
+        for (size_t i = 0; i < frames; ++i) {
+            uint64_t cts = table.times[table.ctsIndex[i]].cts - off;
+            ms[i] = static_cast<double>(cts) / table.timeScale * 1000.0;
+        }
+    });
+}
+
+int mp4fpsmod_set_fps(mp4fpsmod *h, const mp4fpsmod_range *ranges,
+                      size_t count)
+{
+    return guard(h, [&]() {
+        std::vector<FPSRange> spec;
+        for (size_t i = 0; i < count; ++i) {
+            if (ranges[i].fps_num <= 0 || ranges[i].fps_denom <= 0)
+                throw std::runtime_error("invalid frame rate");
+            FPSRange range = { ranges[i].frames, ranges[i].fps_num,
+                               ranges[i].fps_denom };
+            spec.push_back(range);
+        }
+        h->opt.ranges.swap(spec);
+        h->opt.timecodes.clear();
+    });
+}
+
+int mp4fpsmod_set_timecodes(mp4fpsmod *h, const double *ms, size_t count)
+{
+    return guard(h, [&]() {
+        for (size_t i = 1; i < count; ++i)
+            if (ms[i] <= ms[i - 1])
+                throw std::runtime_error("Timecode is not monotone "
+                                         "increasing!");
+        h->opt.timecodes.assign(ms, ms + count);
+        h->opt.timeScale = 1000;
+        h->opt.ranges.clear();
+    });
+}
+
+void mp4fpsmod_set_optimize(mp4fpsmod *h, int enable)
+{
+    h->opt.optimizeTimecode = enable != 0;
+}
+
+void mp4fpsmod_set_compress_dts(mp4fpsmod *h, int enable)
+{
+    h->opt.compressDTS = enable != 0;
+}
+
+void mp4fpsmod_set_delay(mp4fpsmod *h, int ms)
+{
+    h->opt.audioDelay = ms;
+}
+
+void mp4fpsmod_set_timescale(mp4fpsmod *h, int timescale)
+{
+    h->opt.requestedTimeScale = timescale < 0 ? -1 : timescale;
+}
+
+void mp4fpsmod_set_audio_timedelta(mp4fpsmod *h, int delta)
+{
+    h->opt.audioTimeDelta = delta;
+}
+
+void mp4fpsmod_set_max_deviation(mp4fpsmod *h, double ms)
+{
+    h->opt.maxDeviation = ms > 0 ? ms : 0.0;
+}
+
+int mp4fpsmod_write(mp4fpsmod *h, const char *path, const mp4fpsmod_io *io,
+                    void *handle, mp4fpsmod_progress progress, void *arg)
+{
+    return guard(h, [&]() {
+        checkEditable(h);
+        if (h->opt.inplace)
+            throw std::runtime_error("the file is opened for modification");
+        if (!io && !path)
+            throw std::runtime_error("neither path nor io is given");
+        h->done = true;
+        editFile(h->opt, *h->file, 0, h->trackId, &h->table);
+
+        MP4FileCopy copier(h->file);
+        MP4IOCallbacks callbacks;
+        if (io) {
+            copyCallbacks(&callbacks, io);
+            copier.start(&callbacks, handle);
+        } else
+            copier.start(path);
+        uint64_t total = copier.getTotalBytes();
+        if (!io && !h->opt.srcCallbacks) {
+            copier.startParallel(1);
+            while (copier.waitParallel(100))
+                if (progress)
+                    progress(arg, copier.getCopiedBytes(), total);
+        } else {
+            while (copier.copyNextChunk())
+                if (progress)
+                    progress(arg, copier.getCopiedBytes(), total);
+        }
+        copier.finish();
+        if (progress)
+            progress(arg, copier.getCopiedBytes(), total);
+    });
+}
+
+int mp4fpsmod_save(mp4fpsmod *h)
+{
+    return guard(h, [&]() {
+        checkEditable(h);
+        if (!h->opt.inplace)
+            throw std::runtime_error("the file is not opened for "
+                                     "modification");
+        h->done = true;
+        editFile(h->opt, *h->file, 0, h->trackId, &h->table);
+        h->file->Close();
+    });
+}
+
+}
@@ -0,0 +1,261 @@
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <stdexcept>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "directio.h"
+
+const MP4IOCallbacks *DirectWriter::Callbacks()
+{
+    static const MP4IOCallbacks callbacks = {
+        size, seek, read, write, truncate
+    };
+    return &callbacks;
+}
+
+#if !defined(_WIN32)
+
+DirectWriter::DirectWriter(const char *path)
+    : m_path(path), m_fd(-1), m_directFd(-1), m_buffer(0),
+      m_bufferStart(0), m_bufferLength(0), m_pos(0), m_size(0),
+      m_padded(false)
+{
+    m_fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (m_fd < 0)
+        throw std::runtime_error(std::string("cannot create ") + path);
+    void *p;
+    if (posix_memalign(&p, ALIGNMENT, BUFFER_SIZE)) {
+        ::close(m_fd);
+        throw std::runtime_error("cannot allocate direct I/O buffer");
+    }
+    m_buffer = static_cast<uint8_t*>(p);
+#if defined(O_DIRECT)
+    m_directFd = ::open(path, O_WRONLY | O_DIRECT);
+#elif defined(F_NOCACHE)
+    m_directFd = ::open(path, O_WRONLY);
+    if (m_directFd >= 0 && fcntl(m_directFd, F_NOCACHE, 1) == -1) {
+        ::close(m_directFd);
+        m_directFd = -1;
+    }
+#endif
+}
+
+DirectWriter::~DirectWriter()
+{
+    if (m_fd >= 0) {
+        try {
+            Close();
+        } catch (...) {}
+    }
+    std::free(m_buffer);
+}
+
+void DirectWriter::Close()
+{
+    if (m_fd < 0)
+        return;
+    bool failed = flush();
+    if (!failed && m_padded && ::ftruncate(m_fd, m_size) != 0)
+        failed = true;
+    if (m_directFd >= 0)
+        ::close(m_directFd);
+    if (::close(m_fd) != 0)
+        failed = true;
+    m_fd = m_directFd = -1;
+    if (failed)
+        throw std::runtime_error(std::string("cannot write ") + m_path);
+}
+
+bool DirectWriter::writeRegular(const void *buffer, uint64_t size,
+                                uint64_t pos)
+{
+    const uint8_t *p = static_cast<const uint8_t*>(buffer);
+    while (size) {
+        ssize_t n = ::pwrite(m_fd, p, size, pos);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return true;
+        }
+        p += n;
+        pos += n;
+        size -= n;
+    }
+    return false;
+}
+
+/* length is a multiple of ALIGNMENT, written from the start of the buffer */
+bool DirectWriter::writeDirect(uint64_t length)
+{
+    uint64_t done = 0;
+    while (m_directFd >= 0 && done < length) {
+        ssize_t n = ::pwrite(m_directFd, m_buffer + done, length - done,
+                             m_bufferStart + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0 || n % ALIGNMENT) {
+            // the file system doesn't take it after all; carry on with
+            // regular writes from here (a short write is redone)
+            ::close(m_directFd);
+            m_directFd = -1;
+            break;
+        }
+        done += n;
+    }
+    return writeRegular(m_buffer + done, length - done, m_bufferStart + done);
+}
+
+bool DirectWriter::flush()
+{
+    if (!m_bufferLength)
+        return false;
+    uint64_t whole = m_bufferLength & ~static_cast<uint64_t>(ALIGNMENT - 1);
+    uint64_t tail = m_bufferLength - whole;
+    if (tail && m_bufferStart + m_bufferLength >= m_size) {
+        // end of file: pad the last block, truncated back on Close()
+        std::memset(m_buffer + m_bufferLength, 0, ALIGNMENT - tail);
+        whole += ALIGNMENT;
+        tail = 0;
+        m_padded = true;
+    }
+    bool failed = whole && writeDirect(whole);
+    if (!failed && tail)
+        failed = writeRegular(m_buffer + whole, tail, m_bufferStart + whole);
+    m_bufferLength = 0;
+    return failed;
+}
+
+int64_t DirectWriter::size(void *handle)
+{
+    return static_cast<DirectWriter*>(handle)->m_size;
+}
+
+int DirectWriter::seek(void *handle, int64_t pos)
+{
+    if (pos < 0)
+        return 1;
+    static_cast<DirectWriter*>(handle)->m_pos = pos;
+    return 0;
+}
+
+int DirectWriter::read(void *handle, void *buffer, int64_t size, int64_t *nin)
+{
+    DirectWriter *self = static_cast<DirectWriter*>(handle);
+    if (self->flush())
+        return 1;
+    uint64_t avail = self->m_pos < self->m_size
+                   ? self->m_size - self->m_pos : 0;
+    uint64_t want = std::min<uint64_t>(size, avail);
+    uint8_t *p = static_cast<uint8_t*>(buffer);
+    uint64_t done = 0;
+    while (done < want) {
+        ssize_t n = ::pread(self->m_fd, p + done, want - done,
+                            self->m_pos + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return 1;
+        if (n == 0)
+            break;
+        done += n;
+    }
+    self->m_pos += done;
+    *nin = done;
+    return 0;
+}
+
+int DirectWriter::write(void *handle, const void *buffer, int64_t size,
+                        int64_t *nout)
+{
+    DirectWriter *self = static_cast<DirectWriter*>(handle);
+    const uint8_t *p = static_cast<const uint8_t*>(buffer);
+    uint64_t n = size;
+
+    // only writes within or right after the pending block are gathered
+    if (self->m_bufferLength
+            && (self->m_pos < self->m_bufferStart
+                || self->m_pos > self->m_bufferStart + self->m_bufferLength)) {
+        if (self->flush())
+            return 1;
+    }
+    while (n) {
+        uint64_t chunk;
+        if (!self->m_bufferLength) {
+            if (self->m_directFd < 0 || self->m_pos % ALIGNMENT) {
+                // up to the next block boundary through the page cache
+                chunk = n;
+                if (self->m_directFd >= 0)
+                    chunk = std::min<uint64_t>(n,
+                        ALIGNMENT - self->m_pos % ALIGNMENT);
+                if (self->writeRegular(p, chunk, self->m_pos))
+                    return 1;
+                p += chunk;
+                n -= chunk;
+                self->m_pos += chunk;
+                self->m_size = std::max(self->m_size, self->m_pos);
+                continue;
+            }
+            self->m_bufferStart = self->m_pos;
+        }
+        uint64_t offset = self->m_pos - self->m_bufferStart;
+        chunk = std::min<uint64_t>(n, BUFFER_SIZE - offset);
+        std::memcpy(self->m_buffer + offset, p, chunk);
+        self->m_bufferLength = std::max(self->m_bufferLength, offset + chunk);
+        p += chunk;
+        n -= chunk;
+        self->m_pos += chunk;
+        self->m_size = std::max(self->m_size, self->m_pos);
+        if (self->m_bufferLength == BUFFER_SIZE) {
+            bool failed = self->writeDirect(BUFFER_SIZE);
+            self->m_bufferStart += BUFFER_SIZE;
+            self->m_bufferLength = 0;
+            if (failed)
+                return 1;
+        }
+    }
+    *nout = size;
+    return 0;
+}
+
+int DirectWriter::truncate(void *handle, int64_t size)
+{
+    DirectWriter *self = static_cast<DirectWriter*>(handle);
+    if (size < 0 || self->flush() || ::ftruncate(self->m_fd, size) != 0)
+        return 1;
+    self->m_size = size;
+    self->m_padded = false;
+    return 0;
+}
+
+#else
+
+DirectWriter::DirectWriter(const char *path)
+    : m_path(path), m_fd(-1), m_directFd(-1), m_buffer(0),
+      m_bufferStart(0), m_bufferLength(0), m_pos(0), m_size(0),
+      m_padded(false)
+{
+    throw std::runtime_error("direct I/O is not supported on this platform");
+}
+
+DirectWriter::~DirectWriter() {}
+void DirectWriter::Close() {}
+bool DirectWriter::flush() { return true; }
+bool DirectWriter::writeRegular(const void *, uint64_t, uint64_t)
+{
+    return true;
+}
+bool DirectWriter::writeDirect(uint64_t) { return true; }
+int64_t DirectWriter::size(void *) { return -1; }
+int DirectWriter::seek(void *, int64_t) { return 1; }
+int DirectWriter::read(void *, void *, int64_t, int64_t *) { return 1; }
+int DirectWriter::write(void *, const void *, int64_t, int64_t *)
+{
+    return 1;
+}
+int DirectWriter::truncate(void *, int64_t) { return 1; }
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef DIRECTIO_H
+#define DIRECTIO_H
+
+#include <stdint.h>
+#include <string>
+#include "mp4v2/mp4v2.h"
+
+/*
+ * Output file for MP4IOCallbacks that keeps the bulk of the output out of
+ * the page cache.
+ *
+ * Sequential writes starting at a block boundary are gathered in an
+ * aligned buffer and written through a second, O_DIRECT descriptor
+ * (F_NOCACHE on macOS). Everything else, i.e. the head up to the first
+ * boundary, moov/free written at finalize and atom size patches, goes
+ * through the regular descriptor. A partial last block is zero padded
+ * for the direct write and the file is truncated back on Close().
+ *
+ * Falls back to regular writes when the file system refuses direct I/O.
+ */
+class DirectWriter {
+    enum {
+        ALIGNMENT = 4096,
+        BUFFER_SIZE = 8 * 1024 * 1024
+    };
+    std::string m_path;
+    int m_fd;
+    int m_directFd;
+    uint8_t *m_buffer;
+    uint64_t m_bufferStart;
+    uint64_t m_bufferLength;
+    uint64_t m_pos;
+    uint64_t m_size;
+    bool m_padded;
+public:
+    DirectWriter(const char *path);
+    ~DirectWriter();
+    /* flushes and closes; throws std::runtime_error on failure */
+    void Close();
+    bool IsDirect() const { return m_directFd >= 0; }
+
+    static const MP4IOCallbacks *Callbacks();
+private:
+    bool flush();
+    bool writeRegular(const void *buffer, uint64_t size, uint64_t pos);
+    bool writeDirect(uint64_t length);
+
+    static int64_t size(void *handle);
+    static int seek(void *handle, int64_t pos);
+    static int read(void *handle, void *buffer, int64_t size, int64_t *nin);
+    static int write(void *handle, const void *buffer, int64_t size,
+                     int64_t *nout);
+    static int truncate(void *handle, int64_t size);
+
+    DirectWriter(const DirectWriter &);
+    DirectWriter &operator=(const DirectWriter &);
+};
+
+#endif
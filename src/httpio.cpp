@@ -0,0 +1,441 @@
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "ws2_32.lib")
+#endif
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+#include "httpio.h"
+
+namespace {
+
+const intptr_t NO_SOCKET = -1;
+
+void closeSocket(intptr_t s)
+{
+#if defined(_WIN32)
+    closesocket(static_cast<SOCKET>(s));
+#else
+    ::close(static_cast<int>(s));
+#endif
+}
+
+bool startsWithNoCase(const std::string &s, const char *prefix)
+{
+    size_t n = std::strlen(prefix);
+    if (s.size() < n)
+        return false;
+    for (size_t i = 0; i < n; ++i)
+        if (std::tolower(static_cast<unsigned char>(s[i])) != prefix[i])
+            return false;
+    return true;
+}
+
+std::string headerValue(const std::string &line)
+{
+    size_t pos = line.find(':');
+    if (pos == std::string::npos)
+        return std::string();
+    pos = line.find_first_not_of(" \t", pos + 1);
+    return pos == std::string::npos ? std::string() : line.substr(pos);
+}
+
+}
+
+bool HttpReader::IsURL(const char *path)
+{
+    return !std::strncmp(path, "http://", 7) || !std::strncmp(path, "https://", 8);
+}
+
+HttpReader::HttpReader(const char *url)
+    : m_socket(NO_SOCKET), m_recv(64 * 1024), m_recvStart(0), m_recvEnd(0),
+      m_size(UINT64_MAX), m_pos(0), m_lastEnd(0), m_readAhead(0),
+      m_requests(0), m_received(0)
+{
+#if defined(_WIN32)
+    static bool initialized = false;
+    if (!initialized) {
+        WSADATA wsa;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+            throw std::runtime_error("cannot initialize Winsock");
+        initialized = true;
+    }
+#endif
+    setURL(url);
+    /* learns the size, and gets the head of the file in the cache */
+    fetchBlocks(0, 1);
+}
+
+HttpReader::~HttpReader()
+{
+    disconnect();
+}
+
+void HttpReader::setURL(const std::string &url)
+{
+    if (url.compare(0, 7, "http://"))
+        throw std::runtime_error("only http:// URLs are supported: " + url);
+    std::string rest = url.substr(7);
+    size_t slash = rest.find('/');
+    std::string authority = rest.substr(0, slash);
+    m_path = slash == std::string::npos ? "/" : rest.substr(slash);
+    size_t hash = m_path.find('#');
+    if (hash != std::string::npos)
+        m_path.erase(hash);
+    size_t colon = authority.rfind(':');
+    if (colon != std::string::npos && authority.find(']', colon) == std::string::npos) {
+        m_host = authority.substr(0, colon);
+        m_port = authority.substr(colon + 1);
+    } else {
+        m_host = authority;
+        m_port = "80";
+    }
+    if (m_host.size() > 2 && m_host[0] == '[')
+        m_host = m_host.substr(1, m_host.size() - 2);
+    if (m_host.empty())
+        throw std::runtime_error("no host in URL: " + url);
+    m_url = url;
+}
+
+void HttpReader::connect()
+{
+    struct addrinfo hints, *res;
+    std::memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(m_host.c_str(), m_port.c_str(), &hints, &res) != 0)
+        throw std::runtime_error("cannot resolve " + m_host);
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+#if defined(_WIN32)
+        SOCKET s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (s == INVALID_SOCKET)
+            continue;
+#else
+        int s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (s < 0)
+            continue;
+#endif
+        if (::connect(s, ai->ai_addr, static_cast<int>(ai->ai_addrlen)) == 0) {
+            m_socket = static_cast<intptr_t>(s);
+            break;
+        }
+        closeSocket(static_cast<intptr_t>(s));
+    }
+    freeaddrinfo(res);
+    if (m_socket == NO_SOCKET)
+        throw std::runtime_error("cannot connect to " + m_host + ":" + m_port);
+    m_recvStart = m_recvEnd = 0;
+}
+
+void HttpReader::disconnect()
+{
+    if (m_socket != NO_SOCKET)
+        closeSocket(m_socket);
+    m_socket = NO_SOCKET;
+    m_recvStart = m_recvEnd = 0;
+}
+
+void HttpReader::sendAll(const std::string &s)
+{
+    const char *p = s.data();
+    size_t left = s.size();
+    while (left) {
+#if defined(_WIN32)
+        int n = ::send(static_cast<SOCKET>(m_socket), p,
+                       static_cast<int>(std::min<size_t>(left, 0x40000000)), 0);
+#else
+        ssize_t n = ::send(static_cast<int>(m_socket), p, left, MSG_NOSIGNAL);
+#endif
+        if (n <= 0)
+            throw std::runtime_error("connection to " + m_host + " lost");
+        p += n;
+        left -= n;
+    }
+}
+
+/* returns 0 only when the peer closed the connection */
+size_t HttpReader::receive(void *buffer, size_t size)
+{
+    if (m_recvStart < m_recvEnd) {
+        size_t n = std::min(size, m_recvEnd - m_recvStart);
+        std::memcpy(buffer, &m_recv[m_recvStart], n);
+        m_recvStart += n;
+        return n;
+    }
+    /* large reads go straight to the caller's buffer */
+    char *dst = size >= m_recv.size() ? static_cast<char*>(buffer) : &m_recv[0];
+    size_t want = size >= m_recv.size() ? size : m_recv.size();
+#if defined(_WIN32)
+    int n = ::recv(static_cast<SOCKET>(m_socket), dst,
+                   static_cast<int>(std::min<size_t>(want, 0x40000000)), 0);
+#else
+    ssize_t n = ::recv(static_cast<int>(m_socket), dst, want, 0);
+#endif
+    if (n < 0)
+        throw std::runtime_error("connection to " + m_host + " lost");
+    if (dst == buffer)
+        return n;
+    m_recvStart = 0;
+    m_recvEnd = n;
+    return n ? receive(buffer, size) : 0;
+}
+
+std::string HttpReader::receiveLine()
+{
+    std::string line;
+    char c;
+    while (receive(&c, 1) == 1) {
+        if (c == '\n') {
+            if (!line.empty() && line[line.size() - 1] == '\r')
+                line.erase(line.size() - 1);
+            return line;
+        }
+        line += c;
+        if (line.size() > 16384)
+            break;
+    }
+    throw std::runtime_error("bad response from " + m_host);
+}
+
+/*
+ * GETs [offset, offset + size) into buffer; the range is clipped at the
+ * end of the resource, whose size is learned from the response.
+ */
+void HttpReader::fetch(uint64_t offset, uint64_t size, uint8_t *buffer)
+{
+    for (int redirects = 0, retried = 0; ; ) {
+        bool reused = m_socket != NO_SOCKET;
+        if (!reused)
+            connect();
+        char range[64];
+        std::snprintf(range, sizeof range, "bytes=%llu-%llu",
+                      static_cast<unsigned long long>(offset),
+                      static_cast<unsigned long long>(offset + size - 1));
+        std::string status;
+        try {
+            sendAll("GET " + m_path + " HTTP/1.1\r\n"
+                    "Host: " + m_host + (m_port == "80" ? "" : ":" + m_port)
+                    + "\r\n"
+                    "Range: " + range + "\r\n"
+                    "User-Agent: mp4fpsmod\r\n"
+                    "\r\n");
+            status = receiveLine();
+        } catch (const std::runtime_error &) {
+            /* the server may have dropped an idle keep-alive connection */
+            disconnect();
+            if (!reused || retried++)
+                throw;
+            continue;
+        }
+        ++m_requests;
+
+        int code = 0;
+        if (std::sscanf(status.c_str(), "HTTP/%*d.%*d %d", &code) != 1)
+            throw std::runtime_error("bad response from " + m_host);
+        uint64_t contentLength = UINT64_MAX, rangeStart = 0, total = UINT64_MAX;
+        bool close = status.compare(0, 8, "HTTP/1.0") == 0;
+        bool chunked = false;
+        std::string location;
+        for (std::string line; !(line = receiveLine()).empty(); ) {
+            std::string value = headerValue(line);
+            if (startsWithNoCase(line, "content-length:"))
+                contentLength = std::strtoull(value.c_str(), 0, 10);
+            else if (startsWithNoCase(line, "content-range:")) {
+                unsigned long long a, b;
+                char t[32];
+                if (std::sscanf(value.c_str(), "bytes %llu-%llu/%31s", &a, &b, t) == 3) {
+                    rangeStart = a;
+                    if (t[0] != '*')
+                        total = std::strtoull(t, 0, 10);
+                }
+            } else if (startsWithNoCase(line, "connection:"))
+                close = startsWithNoCase(value, "close");
+            else if (startsWithNoCase(line, "transfer-encoding:"))
+                chunked = !startsWithNoCase(value, "identity");
+            else if (startsWithNoCase(line, "location:"))
+                location = value;
+        }
+
+        if (code >= 300 && code < 400 && !location.empty()) {
+            disconnect();
+            if (++redirects > MAX_REDIRECTS)
+                throw std::runtime_error("too many redirects for " + m_url);
+            setURL(location);
+            continue;
+        }
+        if (code == 200) {
+            total = contentLength;
+        } else if (code != 206) {
+            disconnect();
+            throw std::runtime_error(status + " for " + m_url);
+        }
+        if (chunked || contentLength == UINT64_MAX) {
+            disconnect();
+            throw std::runtime_error("unsupported response encoding from " + m_host);
+        }
+        if (total != UINT64_MAX)
+            m_size = total;
+
+        /* a 200 carries the whole file: skip to the range */
+        uint64_t body = contentLength;
+        for (uint64_t skip = offset - std::min(offset, rangeStart); skip && body; ) {
+            char scratch[16384];
+            size_t n = receive(scratch, std::min<uint64_t>(skip, sizeof scratch));
+            if (!n)
+                throw std::runtime_error("connection to " + m_host + " lost");
+            skip -= n;
+            body -= n;
+        }
+        uint64_t want = std::min(size, body);
+        for (uint64_t done = 0; done < want; ) {
+            size_t n = receive(buffer + done, std::min<uint64_t>(want - done, 0x40000000));
+            if (!n)
+                throw std::runtime_error("connection to " + m_host + " lost");
+            done += n;
+        }
+        m_received += want;
+        /* don't wait for the rest of a whole-file response */
+        if (close || want < body)
+            disconnect();
+        if (want < size && offset + want < m_size)
+            throw std::runtime_error("short response from " + m_host);
+        return;
+    }
+}
+
+void HttpReader::fetchBlocks(uint64_t first, uint64_t count)
+{
+    uint64_t offset = first * BLOCK_SIZE;
+    uint64_t size = count * BLOCK_SIZE;
+    if (m_size != UINT64_MAX)
+        size = std::min(size, m_size - offset);
+    std::vector<uint8_t> data(size);
+    fetch(offset, size, data.empty() ? 0 : &data[0]);
+    size = std::min(size, m_size - offset);
+
+    for (uint64_t i = 0; i * BLOCK_SIZE < size; ++i) {
+        uint64_t index = first + i;
+        std::unordered_map<uint64_t, BlockList::iterator>::iterator it =
+            m_index.find(index);
+        if (it != m_index.end()) {
+            m_blocks.erase(it->second);
+            m_index.erase(it);
+        }
+        uint64_t start = i * BLOCK_SIZE;
+        uint64_t end = std::min<uint64_t>(start + BLOCK_SIZE, size);
+        m_blocks.push_front(Block());
+        m_blocks.front().index = index;
+        m_blocks.front().data.assign(data.begin() + start, data.begin() + end);
+        m_index[index] = m_blocks.begin();
+    }
+    while (m_blocks.size() > CACHE_BLOCKS) {
+        m_index.erase(m_blocks.back().index);
+        m_blocks.pop_back();
+    }
+}
+
+const HttpReader::Block *HttpReader::findBlock(uint64_t index)
+{
+    std::unordered_map<uint64_t, BlockList::iterator>::iterator it =
+        m_index.find(index);
+    if (it == m_index.end())
+        return 0;
+    m_blocks.splice(m_blocks.begin(), m_blocks, it->second);
+    return &*it->second;
+}
+
+/* false on a read past the end */
+bool HttpReader::readAt(uint64_t pos, uint8_t *buffer, uint64_t size)
+{
+    if (pos + size > m_size)
+        return false;
+    if (!size)
+        return true;
+    bool forward = pos >= m_lastEnd && pos - m_lastEnd <= BLOCK_SIZE;
+    m_lastEnd = pos + size;
+
+    if (size > CACHE_BLOCKS * static_cast<uint64_t>(BLOCK_SIZE) / 2) {
+        fetch(pos, size, buffer);
+        return true;
+    }
+    uint64_t first = pos / BLOCK_SIZE;
+    uint64_t last = (pos + size - 1) / BLOCK_SIZE;
+    uint64_t numBlocks = (m_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    for (uint64_t index = first; index <= last; ++index) {
+        const Block *block = findBlock(index);
+        if (!block) {
+            /* the run of missing blocks, plus read-ahead */
+            uint64_t end = index + 1;
+            while (end <= last && m_index.find(end) == m_index.end())
+                ++end;
+            m_readAhead = forward
+                ? std::min<uint64_t>(std::max<uint64_t>(m_readAhead * 2, BLOCK_SIZE),
+                                     MAX_READ_AHEAD)
+                : 0;
+            end = std::min(numBlocks, end + m_readAhead / BLOCK_SIZE);
+            fetchBlocks(index, end - index);
+            block = findBlock(index);
+        }
+        uint64_t blockStart = index * BLOCK_SIZE;
+        uint64_t from = std::max(pos, blockStart);
+        uint64_t to = std::min(pos + size, blockStart + block->data.size());
+        std::memcpy(buffer + (from - pos), &block->data[from - blockStart],
+                    to - from);
+    }
+    return true;
+}
+
+const MP4IOCallbacks *HttpReader::Callbacks()
+{
+    static const MP4IOCallbacks callbacks = {
+        size, seek, read, write, 0
+    };
+    return &callbacks;
+}
+
+int64_t HttpReader::size(void *handle)
+{
+    return static_cast<HttpReader*>(handle)->m_size;
+}
+
+int HttpReader::seek(void *handle, int64_t pos)
+{
+    HttpReader *self = static_cast<HttpReader*>(handle);
+    if (pos < 0 || static_cast<uint64_t>(pos) > self->m_size)
+        return 1;
+    self->m_pos = pos;
+    return 0;
+}
+
+int HttpReader::read(void *handle, void *buffer, int64_t size, int64_t *nin)
+{
+    HttpReader *self = static_cast<HttpReader*>(handle);
+    uint64_t n = std::min<uint64_t>(size, self->m_size - self->m_pos);
+    try {
+        if (!self->readAt(self->m_pos, static_cast<uint8_t*>(buffer), n))
+            return 1;
+    } catch (const std::exception &e) {
+        /* mp4v2 only learns that the read failed */
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    self->m_pos += n;
+    *nin = n;
+    return 0;
+}
+
+int HttpReader::write(void *, const void *, int64_t, int64_t *)
+{
+    return 1;
+}
@@ -0,0 +1,84 @@
+#ifndef HTTPIO_H
+#define HTTPIO_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include "mp4v2/mp4v2.h"
+
+/*
+ * Read-only MP4IOCallbacks backend fetching byte ranges of an http:// URL
+ * with Range requests over one keep-alive connection.
+ *
+ * Reads go through an LRU cache of fixed size blocks. A miss fetches the
+ * whole run of missing blocks with one request, extended by a read-ahead
+ * window that doubles while reads keep going forward and collapses on a
+ * jump, so that parsing moov costs a few small requests while streaming
+ * mdat turns into large ones. Reads larger than half the cache bypass it.
+ *
+ * Only plain http is spoken; https and chunked responses are refused.
+ * Redirects to other http URLs are followed.
+ */
+class HttpReader {
+    enum {
+        BLOCK_SIZE = 256 * 1024,
+        CACHE_BLOCKS = 256,
+        MAX_READ_AHEAD = 16 * 1024 * 1024,
+        MAX_REDIRECTS = 5
+    };
+    struct Block {
+        uint64_t index;
+        std::vector<uint8_t> data;
+    };
+    typedef std::list<Block> BlockList;
+
+    std::string m_url;
+    std::string m_host;
+    std::string m_port;
+    std::string m_path;
+    intptr_t m_socket;
+    std::vector<char> m_recv;
+    size_t m_recvStart;
+    size_t m_recvEnd;
+    uint64_t m_size;
+    uint64_t m_pos;
+    uint64_t m_lastEnd;
+    uint64_t m_readAhead;
+    BlockList m_blocks;     // most recently used first
+    std::unordered_map<uint64_t, BlockList::iterator> m_index;
+    uint64_t m_requests;
+    uint64_t m_received;
+public:
+    HttpReader(const char *url);
+    ~HttpReader();
+    uint64_t Size() const { return m_size; }
+    uint64_t Requests() const { return m_requests; }
+    uint64_t BytesReceived() const { return m_received; }
+
+    static bool IsURL(const char *path);
+    static const MP4IOCallbacks *Callbacks();
+private:
+    void setURL(const std::string &url);
+    void connect();
+    void disconnect();
+    void sendAll(const std::string &s);
+    size_t receive(void *buffer, size_t size);
+    std::string receiveLine();
+    void fetch(uint64_t offset, uint64_t size, uint8_t *buffer);
+    void fetchBlocks(uint64_t first, uint64_t count);
+    const Block *findBlock(uint64_t index);
+    bool readAt(uint64_t pos, uint8_t *buffer, uint64_t size);
+
+    static int64_t size(void *handle);
+    static int seek(void *handle, int64_t pos);
+    static int read(void *handle, void *buffer, int64_t size, int64_t *nin);
+    static int write(void *handle, const void *buffer, int64_t size,
+                     int64_t *nout);
+
+    HttpReader(const HttpReader &);
+    HttpReader &operator=(const HttpReader &);
+};
+
+#endif
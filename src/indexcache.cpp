@@ -0,0 +1,149 @@
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include "utf8_codecvt_facet.hpp"
+#include "strcnv.h"
+#endif
+#include "mp4v2wrapper.h"
+#include "journal.h"
+#include "indexcache.h"
+
+using mp4v2::platform::io::File;
+using mp4v2::platform::io::FileSystem;
+
+namespace {
+
+const char MAGIC[8] = { 'M', 'P', '4', 'F', 'P', 'S', 'I', 'X' };
+const uint32_t FORMAT_VERSION = 1;
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t fileSize;
+    int64_t mtime;
+    uint64_t moovOffset;
+    uint64_t moovSize;
+    uint64_t moovHash;
+    uint32_t trackId;
+    uint32_t timeScale;
+    uint64_t entries;
+};
+
+bool readFully(File &file, void *buffer, uint64_t size)
+{
+    File::Size nin;
+    return !file.read(buffer, size, nin) && nin == File::Size(size);
+}
+
+bool writeFully(File &file, const void *buffer, uint64_t size)
+{
+    File::Size nout;
+    return !file.write(buffer, size, nout) && nout == File::Size(size);
+}
+
+}
+
+bool IndexCache::identify(uint64_t *size, int64_t *mtime)
+{
+#if defined(_WIN32)
+    struct _stat64 st;
+    if (_wstat64(m2w(m_source, utf8_codecvt_facet()).c_str(), &st))
+        return false;
+#else
+    struct stat st;
+    if (stat(m_source.c_str(), &st))
+        return false;
+#endif
+    *size = st.st_size;
+    *mtime = st.st_mtime;
+    return true;
+}
+
+bool IndexCache::hashMoov(uint64_t offset, uint64_t size, uint64_t *hash)
+{
+    File file(m_source, File::MODE_READ);
+    if (file.open() || file.seek(offset))
+        return false;
+    std::vector<uint8_t> buffer(std::min<uint64_t>(size, 1 << 20));
+    uint64_t h = CopyJournal::Hash(0, 0);
+    for (uint64_t done = 0; done < size; ) {
+        uint64_t n = std::min<uint64_t>(size - done, buffer.size());
+        if (!readFully(file, &buffer[0], n))
+            return false;
+        h = CopyJournal::Hash(&buffer[0], n, h);
+        done += n;
+    }
+    *hash = h;
+    return true;
+}
+
+bool IndexCache::Load(uint32_t *trackId, SampleTable *table)
+{
+    File file(m_path, File::MODE_READ);
+    if (!FileSystem::isFile(m_path) || file.open())
+        return false;
+    Header header;
+    if (!readFully(file, &header, sizeof header)
+            || std::memcmp(header.magic, MAGIC, sizeof MAGIC)
+            || header.version != FORMAT_VERSION
+            || header.byteOrder != BYTE_ORDER_MARK
+            || header.entries == 0
+            || uint64_t(file.size) != sizeof header + header.entries
+                * (sizeof(SampleTime) + sizeof(uint32_t)))
+        return false;
+
+    uint64_t size, hash;
+    int64_t mtime;
+    if (!identify(&size, &mtime)
+            || size != header.fileSize || mtime != header.mtime
+            || !hashMoov(header.moovOffset, header.moovSize, &hash)
+            || hash != header.moovHash)
+        return false;
+
+    table->timeScale = header.timeScale;
+    table->times.resize(header.entries);
+    table->ctsIndex.resize(header.entries);
+    if (!readFully(file, &table->times[0],
+                   header.entries * sizeof(SampleTime))
+            || !readFully(file, &table->ctsIndex[0],
+                          header.entries * sizeof(uint32_t)))
+        return false;
+    *trackId = header.trackId;
+    return true;
+}
+
+bool IndexCache::Save(uint32_t trackId, const SampleTable &table,
+                      uint64_t moovOffset, uint64_t moovSize)
+{
+    Header header;
+    std::memset(&header, 0, sizeof header);
+    std::memcpy(header.magic, MAGIC, sizeof MAGIC);
+    header.version = FORMAT_VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.moovOffset = moovOffset;
+    header.moovSize = moovSize;
+    header.trackId = trackId;
+    header.timeScale = table.timeScale;
+    header.entries = table.times.size();
+    if (!header.entries || table.ctsIndex.size() != header.entries
+            || !identify(&header.fileSize, &header.mtime)
+            || !hashMoov(moovOffset, moovSize, &header.moovHash))
+        return false;
+
+    /* replace the cache as a whole, so that it is never seen half written */
+    std::string tmp = m_path + ".tmp";
+    File file(tmp, File::MODE_CREATE);
+    if (file.open() || !writeFully(file, &header, sizeof header)
+            || !writeFully(file, &table.times[0],
+                           header.entries * sizeof(SampleTime))
+            || !writeFully(file, &table.ctsIndex[0],
+                           header.entries * sizeof(uint32_t))
+            || file.close())
+        return false;
+    return !FileSystem::rename(tmp, m_path);
+}
@@ -0,0 +1,48 @@
+#ifndef INDEXCACHE_H
+#define INDEXCACHE_H
+
+#include <stdint.h>
+#include <string>
+#include "mp4trackx.h"
+
+/*
+ * Sidecar cache of the decoded sample table of the video track
+ * (see TrackEditor), so that reruns against the same input skip decoding
+ * stts/ctts, and -p skips parsing the file altogether.
+ *
+ * The cache is a fixed header followed by the sample times and the CTS
+ * order as flat arrays, in native byte order and laid out so that they
+ * could be mapped as they are:
+ *
+ *   magic "MP4FPSIX", version, byte order mark
+ *   input size, mtime, moov offset, size and hash
+ *   track id, time scale, number of entries (frames + 1)
+ *   SampleTime[entries]  (dts, cts)
+ *   uint32_t[entries]    (sample indices in CTS order)
+ *
+ * It is used only while the input keeps its size and mtime, and its moov
+ * still hashes the same; otherwise it is rebuilt.
+ */
+class IndexCache {
+    std::string m_path;
+    std::string m_source;
+public:
+    IndexCache(const char *path, const char *source)
+        : m_path(path), m_source(source) {}
+    /* false if there is no cache for the input as it is now */
+    bool Load(uint32_t *trackId, SampleTable *table);
+    /*
+     * moov is at [moovOffset, moovOffset + moovSize) of the input.
+     * Returns false if the cache could not be written.
+     */
+    bool Save(uint32_t trackId, const SampleTable &table,
+              uint64_t moovOffset, uint64_t moovSize);
+private:
+    bool identify(uint64_t *size, int64_t *mtime);
+    bool hashMoov(uint64_t offset, uint64_t size, uint64_t *hash);
+
+    IndexCache(const IndexCache &);
+    IndexCache &operator=(const IndexCache &);
+};
+
+#endif
@@ -0,0 +1,147 @@
+#include <cstdio>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#if defined(_WIN32)
+#include "utf8_codecvt_facet.hpp"
+#include "strcnv.h"
+#endif
+#include "mp4v2wrapper.h"
+#include "journal.h"
+
+using mp4v2::platform::io::File;
+using mp4v2::platform::io::FileSystem;
+
+namespace {
+
+const char MAGIC[] = "mp4fpsmod journal 1";
+
+}
+
+uint64_t CopyJournal::Hash(const void *data, size_t size, uint64_t hash)
+{
+    const uint8_t *p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+bool CopyJournal::Exists() const
+{
+    return FileSystem::exists(m_path);
+}
+
+bool CopyJournal::Open(uint64_t layout, bool resume)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_layout = layout;
+    m_done.clear();
+    std::map<uint64_t, uint64_t> done;
+    if (!resume || !Exists() || !load(&done))
+        return false;
+    m_done.swap(done);
+    return true;
+}
+
+/* false if the journal is damaged or for another layout */
+bool CopyJournal::load(std::map<uint64_t, uint64_t> *done)
+{
+    File file(m_path, File::MODE_READ);
+    if (file.open())
+        return false;
+    std::string text(file.size, '\0');
+    File::Size nin;
+    if (text.empty() || file.read(&text[0], text.size(), nin))
+        return false;
+
+    size_t pos = text.rfind("check ");
+    if (pos == std::string::npos)
+        return false;
+    uint64_t check;
+    std::istringstream tail(text.substr(pos + 6));
+    if (!(tail >> std::hex >> check) || check != Hash(text.data(), pos))
+        return false;
+
+    std::istringstream is(text.substr(0, pos));
+    std::string line, key;
+    if (!std::getline(is, line) || line != MAGIC)
+        return false;
+    uint64_t layout;
+    if (!(is >> key >> std::hex >> layout) || key != "layout"
+            || layout != m_layout)
+        return false;
+    uint64_t start, end;
+    while (is >> key >> std::dec >> start >> end) {
+        if (key != "done" || start > end)
+            return false;
+        (*done)[start] = end;
+    }
+    return true;
+}
+
+bool CopyJournal::IsDone(uint64_t start, uint64_t end) const
+{
+    std::map<uint64_t, uint64_t>::const_iterator it = m_done.upper_bound(start);
+    if (it == m_done.begin())
+        return false;
+    --it;
+    return it->second >= end;
+}
+
+void CopyJournal::Record(uint64_t start, uint64_t end)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    /* merge with the ranges it overlaps or touches */
+    std::map<uint64_t, uint64_t>::iterator it = m_done.upper_bound(start);
+    if (it != m_done.begin()) {
+        std::map<uint64_t, uint64_t>::iterator prev = it;
+        --prev;
+        if (prev->second >= start) {
+            start = prev->first;
+            end = std::max(end, prev->second);
+            it = prev;
+        }
+    }
+    while (it != m_done.end() && it->first <= end) {
+        end = std::max(end, it->second);
+        m_done.erase(it++);
+    }
+    m_done[start] = end;
+    save();
+}
+
+void CopyJournal::save()
+{
+    std::ostringstream os;
+    os << MAGIC << "\n"
+       << "layout " << std::hex << std::setw(16) << std::setfill('0')
+       << m_layout << std::dec << "\n";
+    std::map<uint64_t, uint64_t>::const_iterator it;
+    for (it = m_done.begin(); it != m_done.end(); ++it)
+        os << "done " << it->first << " " << it->second << "\n";
+    std::string text = os.str();
+    os << "check " << std::hex << std::setw(16) << std::setfill('0')
+       << Hash(text.data(), text.size()) << "\n";
+    text = os.str();
+
+    /* replace the journal as a whole, so that it is never seen half written */
+    std::string tmp = m_path + ".tmp";
+    File file(tmp, File::MODE_CREATE);
+    File::Size nout;
+    if (file.open() || file.write(text.data(), text.size(), nout)
+            || file.sync() || file.close()
+            || FileSystem::rename(tmp, m_path))
+        throw std::runtime_error("cannot write journal " + m_path);
+}
+
+void CopyJournal::Remove()
+{
+#if defined(_WIN32)
+    _wremove(m2w(m_path, utf8_codecvt_facet()).c_str());
+#else
+    std::remove(m_path.c_str());
+#endif
+}
@@ -0,0 +1,59 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <mutex>
+
+/*
+ * Checkpoint journal of a planned copy (see MP4FileCopy::startParallel()).
+ *
+ * Records which byte ranges of the output are durably written, under a
+ * hash of the chunk layout they belong to. A rerun that plans the same
+ * layout into the same output file skips those ranges.
+ *
+ * The journal is a few lines of text, replaced as a whole through a
+ * temporary file on every update:
+ *
+ *   mp4fpsmod journal 1
+ *   layout <hash>
+ *   done <start> <end>
+ *   ...
+ *   check <hash of the lines above>
+ *
+ * A journal that fails the check, or was made for another layout, is
+ * ignored and the copy starts over.
+ */
+class CopyJournal {
+    std::string m_path;
+    uint64_t m_layout;
+    std::map<uint64_t, uint64_t> m_done;
+    std::mutex m_mutex;
+public:
+    CopyJournal(const char *path) : m_path(path), m_layout(0) {}
+    bool Exists() const;
+    /*
+     * Starts journaling for the given layout. With resume, picks up an
+     * earlier journal for it and returns true if there was one; IsDone()
+     * then tells what it covers.
+     */
+    bool Open(uint64_t layout, bool resume);
+    bool IsDone(uint64_t start, uint64_t end) const;
+    /* adds [start, end), which must already be synced, and saves */
+    void Record(uint64_t start, uint64_t end);
+    /* removes the journal once the copy is complete */
+    void Remove();
+
+    /* FNV-1a, for the layout and check hashes */
+    static uint64_t Hash(const void *data, size_t size,
+                         uint64_t hash = 0xcbf29ce484222325ULL);
+private:
+    bool load(std::map<uint64_t, uint64_t> *done);
+    void save();
+
+    CopyJournal(const CopyJournal &);
+    CopyJournal &operator=(const CopyJournal &);
+};
+
+#endif
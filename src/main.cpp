@@ -1,9 +1,8 @@
 #include <cstdio>
-#include <cmath>
-#include <fstream>
-#include <sstream>
-#include <numeric>
+#include <cstring>
 #include <algorithm>
+#include <thread>
+#include <mutex>
 #if defined(_WIN32)
 #include <windows.h>
 #include "utf8_codecvt_facet.hpp"
@@ -16,403 +15,249 @@
 #endif
 #include "mp4filex.h"
 #include "mp4trackx.h"
+#include "retime.h"
+#include "progress.h"
+#include "memoryio.h"
+#include "mp4stream.h"
+#include "directio.h"
+#include "journal.h"
+#include "httpio.h"
+#include "indexcache.h"
+#include "server.h"
 #include "mp4v2/project.h"
 
-struct Option {
-    const char *src, *dst, *timecodeFile;
-    bool inplace;
-    bool compressDTS;
-    bool optimizeTimecode;
-    bool printOnly;
-    uint32_t originalTimeScale;
-    uint32_t timeScale;
-    int requestedTimeScale;
-    int audioDelay;
-    int audioTimeDelta;
-    std::vector<FPSRange> ranges;
-    std::vector<double> timecodes;
-    std::vector<std::pair<size_t, double> > averages;
-
-    Option()
-    {
-        src = 0;
-        dst = 0;
-        timecodeFile = 0;
-        inplace = false;
-        compressDTS = false;
-        optimizeTimecode = false;
-        printOnly = false;
-        requestedTimeScale = 0;
-        timeScale = 1000;
-        audioDelay = 0;
-        audioTimeDelta = 0;
-    }
-    bool modified() {
-        return compressDTS || audioDelay || ranges.size()
-            || timecodes.size() || optimizeTimecode || requestedTimeScale > 0 || audioTimeDelta > 0;
-    }
-};
-
-bool convertToExactRanges(Option &opt)
+void execute(Option &opt)
 {
-    struct FPSSpec {
-        double delta;
-        int num, denom;
-    } wellKnown[] = {
-        { 0, 18000, 1001 },
-        { 0, 24000, 1001 },
-        { 0, 25, 1 },
-        { 0, 30000, 1001 },
-        { 0, 50, 1 },
-        { 0, 60000, 1001 }
-    };
-    FPSSpec *sp, *spEnd = wellKnown + 5;
-    for (sp = wellKnown; sp != spEnd; ++sp)
-        sp->delta = static_cast<double>(sp->denom) / sp->num * opt.timeScale;
-
-    std::vector<FPSRange> ranges;
-    std::vector<std::pair<size_t, double> >::const_iterator dp;
-    for (dp = opt.averages.begin(); dp != opt.averages.end(); ++dp) {
-        double delta = dp->second;
-        double bound = std::max(1.0 / dp->first, 0.00048828125);
-        for (sp = wellKnown; sp != spEnd; ++sp) {
-            /* test if it's close enough to one of the well known rate. */
-            double diff = std::abs(delta - sp->delta);
-            if (diff < bound) {
-                FPSRange range = { static_cast<uint32_t>(dp->first), sp->num, sp->denom };
-                ranges.push_back(range);
-                break;
+    try {
+        //mp4v2::impl::log.setVerbosity(MP4_LOG_VERBOSE3);
+        mp4v2::impl::log.setVerbosity(MP4_LOG_NONE);
+        IndexCache index(opt.indexFile ? opt.indexFile : "", opt.src);
+        SampleTable table;
+        uint32_t cachedTrack = 0;
+        bool cached = opt.indexFile && index.Load(&cachedTrack, &table);
+        if (cached && opt.printOnly) {
+            std::fprintf(stderr, "Using index cache\n");
+            TrackEditor editor(0, &table);
+            printTimeCodes(opt, editor);
+            return;
+        }
+        mp4v2::impl::MP4File file;
+        file.SetParseThreads(opt.threads);
+        std::fprintf(stderr, "Reading MP4 stream...\n");
+        if (opt.inplace)
+            file.Modify(opt.src, opt.srcCallbacks, opt.srcHandle);
+        else
+            file.Read(opt.src, 0, opt.srcCallbacks, opt.srcHandle);
+        std::fprintf(stderr, "Done reading\n");
+        if (!editFile(opt, file, opt.indexFile ? &index : 0, cachedTrack,
+                      cached ? &table : 0))
+            return;
+        if (opt.inplace)
+            file.Close();
+        else {
+            std::fprintf(stderr, "Saving MP4 stream...\n");
+            MP4FileCopy copier(&file);
+            CopyJournal journal(opt.journalFile ? opt.journalFile : "");
+            bool resume = false;
+            if (opt.journalFile) {
+                copier.setJournal(&journal);
+                resume = journal.Exists()
+                    && mp4v2::platform::io::FileSystem::isFile(opt.dst);
+            }
+            if (opt.dstCallbacks)
+                copier.start(opt.dstCallbacks, opt.dstHandle);
+            else
+                copier.start(opt.dst, resume);
+            Progress progress(opt.progressFormat, opt.progressFd);
+            progress.Begin(copier.getTotalBytes(), copier.getTotalChunks());
+            if (!opt.srcCallbacks && !opt.dstCallbacks) {
+                copier.startParallel(opt.copyThreads);
+                if (copier.getCopiedBytes())
+                    progress.Message("resume", "Resuming from the journal");
+                while (copier.waitParallel(100))
+                    progress.Update(copier.getCopiedBytes(),
+                                    copier.getCopiedChunks());
+                progress.Update(copier.getCopiedBytes(),
+                                copier.getCopiedChunks());
+            } else {
+                for (uint64_t i = 1; copier.copyNextChunk(); ++i)
+                    progress.Update(copier.getCopiedBytes(), i);
             }
+            copier.finish();
+            if (opt.journalFile)
+                journal.Remove();
+            progress.Finish();
         }
-        if (sp == spEnd)
-            return false;
-    }
-    std::fprintf(stderr, "Converted to exact fps ranges\n");
-    for (size_t i = 0; i < ranges.size(); ++i) {
-        std::fprintf(stderr, "%d frames: fps %d/%d\n",
-            ranges[i].numFrames, ranges[i].fps_num, ranges[i].fps_denom);
+        std::fprintf(stderr, "\nOperation completed with no problem\n");
+    } catch (mp4v2::impl::Exception *e) {
+        handle_mp4error(e);
     }
-    opt.ranges.swap(ranges);
-    return true;
 }
 
 /*
- * divide sequence like 1, 2, 1, 1, 2, 3, 2, 3, 3, 2, 1, 1, 2
- * into groups:
- * (1, 2, 1, 1, 2), (3, 2, 3, 3, 2), (1, 1, 2)
- *
- * each group can hold continuous numbers within [n, n + 1] for some n.
+ * Pipe mode ("-" as input or output): one forward pass without seeks,
+ * which requires moov to precede mdat in the input.
  */
-template <typename T, typename InputIterator>
-void groupbyAdjacent(InputIterator begin, InputIterator end,
-        std::vector<std::vector<T> > *result)
-{
-    std::vector<std::vector<T> > groups;
-    T low = 1, high = 0;
-    for (; begin != end; ++begin) {
-        if (*begin < low || *begin > high) {
-            groups.push_back(std::vector<T>());
-            low = *begin - 1;
-            high = *begin + 1;
-        } else {
-            T prev = groups.back().back();
-            if (prev != *begin && high - low == 2) {
-                low = std::min(prev, *begin);
-                high = std::max(prev, *begin);
-            }
-        }
-        groups.back().push_back(*begin);
-    }
-    result->swap(groups);
-}
-
-void averageTimecode(Option &opt)
-{
-    std::vector<double> &tc = opt.timecodes;
-    std::vector<int> deltas;
-    int prev = tc[0] + 0.5;
-    for (std::vector<double>::const_iterator ii = ++tc.begin();
-            ii != tc.end(); ++ii) {
-        deltas.push_back(*ii - prev + 0.5);
-        prev = *ii + 0.5;
-    }
-
-    std::vector<std::vector<int> > groups;
-    groupbyAdjacent(deltas.begin(), deltas.end(), &groups);
-
-    for (std::vector<std::vector<int> >::const_iterator kk = groups.begin();
-            kk != groups.end(); ++kk) {
-        uint64_t sum = std::accumulate(kk->begin(), kk->end(), 0ULL);
-        double average = static_cast<double>(sum) / kk->size();
-        opt.averages.push_back(std::make_pair(kk->size(), average));
-    }
-    std::fprintf(stderr, "Divided into %d group%s\n",
-            int(groups.size()), (groups.size() == 1) ? "" : "s");
-    for (size_t i = 0; i < opt.averages.size(); ++i) {
-        std::fprintf(stderr, "%d frames: time delta %g\n",
-                int(opt.averages[i].first), opt.averages[i].second);
-    }
-
-    tc.clear();
-    tc.push_back(0.0);
-    for (size_t i = 0; i < groups.size(); ++i) {
-        for (size_t j = 0; j < groups[i].size(); ++j)
-            tc.push_back(tc.back() + opt.averages[i].second);
-    }
-}
-
-void rescaleTimecode(Option &opt)
+void executeStream(Option &opt)
 {
-    size_t n = opt.timecodes.size();
-    if (n < 2) return;
-    double delta = opt.timecodes[n-1] - opt.timecodes[n-2];
-    double duration = opt.timecodes[n-1] + delta;
-    double scale = 1;
-
-    if (opt.requestedTimeScale == 0) {
-        double scaleMax = 0x7fffffff / duration;
-        if (scaleMax < 1.0) {
-            while (scale > scaleMax)
-                scale /= 10.0;
-        } else if (opt.timeScale < 100) {
-            scaleMax = std::min(scaleMax, 10000.0 / opt.timeScale);
-            while (scale < scaleMax)
-                scale *= 10.0;
-            scale /= 10.0;
-        }
+    try {
+        mp4v2::impl::log.setVerbosity(MP4_LOG_NONE);
+        StreamReader in(opt.src);
+        MP4StreamCopy copier(in);
+        std::fprintf(stderr, "Reading MP4 stream...\n");
+        copier.readHead();
+        MemoryReader reader(copier.getHead(), copier.getHeadSize());
+        mp4v2::impl::MP4File file;
+        file.SetParseThreads(opt.threads);
+        file.Read(0, 0, MemoryReader::Callbacks(), &reader);
+        std::fprintf(stderr, "Done reading\n");
+        if (!editFile(opt, file))
+            return;
+        std::fprintf(stderr, "Saving MP4 stream...\n");
+        StreamWriter out(opt.dst);
+        copier.start(&file, &out);
+        Progress progress(opt.progressFormat, opt.progressFd);
+        progress.Begin(copier.getTotalBytes(), copier.getTotalChunks());
+        while (copier.copyNextBlock())
+            progress.Update(copier.getCopiedBytes(),
+                            copier.getCopiedChunks());
+        copier.finish();
+        progress.Finish();
+        std::fprintf(stderr, "\nOperation completed with no problem\n");
+    } catch (mp4v2::impl::Exception *e) {
+        handle_mp4error(e);
     }
-    else if (opt.requestedTimeScale > 0)
-        scale = double(opt.requestedTimeScale) / opt.timeScale;
-    else
-        scale = double(opt.originalTimeScale) / opt.timeScale;
-
-    for (size_t i = 0; i < n; ++i)
-       opt.timecodes[i] *= scale;
-    opt.timeScale *= scale;
 }
 
-void parseTimecodeV2(Option &opt, std::istream &is, size_t count)
+/*
+ * Loads the whole input into memory, edits it there and writes the result
+ * out in one go; the file system is touched only at both ends.
+ */
+void executeInMemory(Option &opt)
 {
-    std::string line;
-    bool is_float = false;
-    size_t nline = 0;
-    while (opt.timecodes.size() < count && std::getline(is, line)) {
-        ++nline;
-        if (line.size() && line[0] == '#')
-            continue;
-        double stamp;
-        if (std::strchr(line.c_str(), '.')) is_float = true;
-        if (std::sscanf(line.c_str(), "%lf", &stamp) == 1) {
-            if (opt.timecodes.size() && stamp <= opt.timecodes.back()) {
-                std::stringstream msg;
-                msg << "Timecode is not monotone increasing! at line " << nline;
-                throw std::runtime_error(msg.str());
-            }
-            opt.timecodes.push_back(stamp);
-        }
-    }
-    if (!opt.timecodes.size())
-        throw std::runtime_error("No entry in the timecode file");
-    if (opt.timecodes.size() == count -1 && opt.timecodes.size() >= 2) {
-        double last = opt.timecodes[opt.timecodes.size()-1];
-        double prev = opt.timecodes[opt.timecodes.size()-2];
-        opt.timecodes.push_back(last * 2 - prev);
+    MemorySink source;
+    source.Load(opt.src);
+    if (opt.inplace) {
+        opt.srcCallbacks = MemorySink::Callbacks();
+        opt.srcHandle = &source;
+        execute(opt);
+        source.Save(opt.src);
+        return;
     }
-    if (opt.optimizeTimecode)
-        averageTimecode(opt);
-}
-
-#ifdef _WIN32
-void loadTimecodeV2(Option &option, size_t count)
-{
-    std::wstring wfname = m2w(option.timecodeFile, utf8_codecvt_facet());
-
-    HANDLE fh = CreateFileW(wfname.c_str(), GENERIC_READ,
-        FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
-    if (fh == INVALID_HANDLE_VALUE)
-        throw std::runtime_error("Can't open timecode file");
-
-    DWORD nread;
-    char buffer[8192];
-    std::stringstream ss;
-    while (ReadFile(fh, buffer, sizeof buffer, &nread, 0) && nread > 0)
-        ss.write(buffer, nread);
-    CloseHandle(fh);
-
-    ss.seekg(0);
-    parseTimecodeV2(option, ss, count);
-}
-#else
-void loadTimecodeV2(Option &option, size_t count)
-{
-    std::ifstream ifs(option.timecodeFile);
-    if (!ifs)
-        throw std::runtime_error("Can't open timecode file");
-    parseTimecodeV2(option, ifs, count);
-}
-#endif
-
-void printTimeCodes(const Option &opt, TrackEditor &track)
-{
-#ifdef _WIN32
-    utf8_codecvt_facet u8codec;
-    std::wstring wname = m2w(opt.timecodeFile, utf8_codecvt_facet());
-    FILE *fp = std::strcmp(opt.timecodeFile, "-")
-               ? _wfopen(wname.c_str(), L"w")
-               : stdout;
-#else
-    FILE *fp = std::strcmp(opt.timecodeFile, "-")
-               ? std::fopen(opt.timecodeFile, "w")
-               : stdout;
-#endif
-    if (!fp)
-        throw std::runtime_error("Can't open timecode file");
-    uint32_t timeScale = track.GetTimeScale();
-    std::fputs("# timecode format v2\n", fp);
-    if (track.GetFrameCount()) {
-        uint64_t off = track.CTS(0);
-        for (size_t i = 0; i < track.GetFrameCount(); ++i) {
-            uint64_t cts = track.CTS(i) - off;
-            std::fprintf(fp, "%.15g\n",
-                static_cast<double>(cts) / timeScale * 1000.0);
-        }
+    MemoryReader reader(source.Data(), source.Size());
+    opt.srcCallbacks = MemoryReader::Callbacks();
+    opt.srcHandle = &reader;
+    MemorySink output;
+    if (!opt.printOnly) {
+        output.Reserve(source.Size() + 0x10000);
+        opt.dstCallbacks = MemorySink::Callbacks();
+        opt.dstHandle = &output;
     }
-    std::fclose(fp);
+    execute(opt);
+    if (!opt.printOnly)
+        output.Save(opt.dst);
 }
 
-std::list<double> fixAudioTimeCodes(Option& opt, mp4v2::impl::MP4File &file, TrackEditor &vtrackeditor)
+/*
+ * Writes the output with direct I/O, bypassing the page cache for mdat.
+ */
+void executeDirect(Option &opt)
 {
-    MP4TrackId atrackId = file.FindTrackId(0, MP4_AUDIO_TRACK_TYPE);
-    MP4TrackX* atrack = reinterpret_cast<MP4TrackX*>(file.GetTrack(atrackId));
-    double timescale = atrack->GetTimeScale();
-    TrackEditor aeditor(reinterpret_cast<MP4TrackX*>(atrack));
-    size_t cnt = aeditor.GetFrameCount();
-    std::list<double> vctsList, fixedVctsList;
-    for (size_t i = 0; i < vtrackeditor.GetFrameCount() + 1; ++i)
-        vctsList.push_back(vtrackeditor.CTS(i));
-
-    int64_t dts_diff = 0;
-    const double alpha = 0.2;
-    double timeDelta = 0;
-    for (size_t i = 1; i <= cnt; ++i) {
-        double dts = aeditor.DTS(i);
-        double fixed = opt.audioTimeDelta * i;
-        while (vctsList.size()) {
-            double vcts = vctsList.front();
-            if (vcts * aeditor.GetTimeScale() / vtrackeditor.GetTimeScale() > dts) break;
-            double newvcts = vcts * fixed / dts;
-            if (!fixedVctsList.size()) {
-                fixedVctsList.push_back(newvcts);
-            } else if (timeDelta == 0) {
-                timeDelta = newvcts - fixedVctsList.back();
-                fixedVctsList.push_back(newvcts);
-            } else  {
-                double lastCts = fixedVctsList.back();
-                timeDelta = alpha * (newvcts - lastCts) + (1.0 - alpha) * timeDelta;
-                fixedVctsList.push_back(lastCts + timeDelta);
-            }
-            dts_diff = newvcts - vcts;
-            vctsList.pop_front();
-        }
-    }
-    while (vctsList.size()) {
-        double vcts = vctsList.front();
-        fixedVctsList.push_back(vcts + dts_diff);
-        vctsList.pop_front();
+    if (opt.printOnly) {
+        execute(opt);
+        return;
     }
-
-    int nstts = atrack->SttsCountProperty()->GetValue();
-    atrack->SttsCountProperty()->IncrementValue(-1 * nstts);
-    atrack->SttsSampleCountProperty()->SetCount(0);
-    atrack->SttsSampleDeltaProperty()->SetCount(0);
-    atrack->SttsCountProperty()->IncrementValue();
-    atrack->SttsSampleCountProperty()->AddValue(cnt);
-    atrack->SttsSampleDeltaProperty()->AddValue(opt.audioTimeDelta);
-    atrack->MediaDurationProperty()->SetValue(0);
-    atrack->UpdateDurationsX(cnt * opt.audioTimeDelta);
-
-    return fixedVctsList;
+    DirectWriter output(opt.dst);
+    if (!output.IsDirect())
+        std::fprintf(stderr, "Direct I/O is not available for %s, "
+                     "using regular writes\n", opt.dst);
+    opt.dstCallbacks = DirectWriter::Callbacks();
+    opt.dstHandle = &output;
+    execute(opt);
+    output.Close();
 }
 
-void execute(Option &opt)
+/*
+ * Writes one output per variant of --and from a single parse of the
+ * input, reading its media data once for all of them.
+ */
+void executeFanOut(Option &opt)
 {
     try {
-        //mp4v2::impl::log.setVerbosity(MP4_LOG_VERBOSE3);
         mp4v2::impl::log.setVerbosity(MP4_LOG_NONE);
+        IndexCache index(opt.indexFile ? opt.indexFile : "", opt.src);
+        SampleTable table;
+        uint32_t cachedTrack = 0;
+        bool cached = opt.indexFile && index.Load(&cachedTrack, &table);
         mp4v2::impl::MP4File file;
+        file.SetParseThreads(opt.threads);
         std::fprintf(stderr, "Reading MP4 stream...\n");
-        if (opt.inplace)
-            file.Modify(opt.src, 0, 0);
-        else
-            file.Read(opt.src, 0, 0, 0);
+        file.Read(opt.src, 0, opt.srcCallbacks, opt.srcHandle);
         std::fprintf(stderr, "Done reading\n");
+
+        /* every variant starts from the sample table as read */
         MP4TrackId trackId = file.FindTrackId(0, MP4_VIDEO_TRACK_TYPE);
-        mp4v2::impl::MP4Track *track = file.GetTrack(trackId);
-        // XXX
-        TrackEditor editor(reinterpret_cast<MP4TrackX*>(track));
-        opt.originalTimeScale = editor.GetTimeScale();
-        if (opt.printOnly) {
-            printTimeCodes(opt, editor);
-            return;
+        if (!cached || cachedTrack != trackId) {
+            TrackEditor(reinterpret_cast<MP4TrackX*>(file.GetTrack(trackId)))
+                .SaveTable(&table);
+            mp4v2::impl::MP4Atom *moov = file.FindAtom("moov");
+            if (opt.indexFile && !index.Save(trackId, table, moov->GetStart(),
+                                             moov->GetSize()))
+                std::fprintf(stderr, "Cannot write index cache %s\n",
+                             opt.indexFile);
         }
-        editor.SetAudioDelay(opt.audioDelay);
-        if (opt.compressDTS)
-            editor.EnableDTSCompression(true);
-        if (opt.ranges.size())
-            editor.SetFPS(&opt.ranges[0], opt.ranges.size(),
-                          opt.requestedTimeScale);
-        else if (opt.timecodeFile || opt.modified()) {
-            if (opt.timecodeFile)
-                loadTimecodeV2(opt, editor.GetFrameCount() + 1);
-            else if (opt.audioTimeDelta > 0) {
-                std::list<double> vctsList = fixAudioTimeCodes(opt, file, editor);
-                opt.timeScale = opt.originalTimeScale;
-                for (auto it = vctsList.begin(); it != vctsList.end(); ++it) {
-                    opt.timecodes.push_back(*it);
-                }
-                if (opt.optimizeTimecode)
-                    averageTimecode(opt);
-            }
-            else {
-                uint64_t off = editor.CTS(0);
-                opt.timeScale = opt.originalTimeScale;
-                for (size_t i = 0; i < editor.GetFrameCount() + 1; ++i)
-                    opt.timecodes.push_back(editor.CTS(i) - off);
-                if (opt.optimizeTimecode)
-                    averageTimecode(opt);
-            }
-            if (opt.optimizeTimecode && convertToExactRanges(opt))
-                editor.SetFPS(&opt.ranges[0], opt.ranges.size(),
-                              opt.requestedTimeScale);
-            else {
-                rescaleTimecode(opt);
-                editor.SetTimeCodes(&opt.timecodes[0],
-                        opt.timecodes.size(),
-                        opt.timeScale);
-            }
-        }
-        if (opt.modified()) {
-            editor.AdjustTimeCodes();
-            editor.DoEditTimeCodes();
+
+        std::vector<Option> variants;
+        for (size_t i = 0; i < opt.variants.size(); ++i) {
+            Option variant = opt;
+            variant.variants.clear();
+            variant.setEdits(opt.variants[i]);
+            variants.push_back(variant);
         }
-        if (opt.inplace)
-            file.Close();
-        else {
-            std::fprintf(stderr, "Saving MP4 stream...\n");
-            MP4FileCopy copier(&file);
-            copier.start(opt.dst);
-            uint64_t count = copier.getTotalChunks();
-            for (uint64_t i = 1; copier.copyNextChunk(); ++i) {
-                std::fprintf(stderr, "\rWriting chunk %" PRId64 "/%" PRId64 "...",
-                        i, count);
-            }
+        EditCheckpoint checkpoint(file);
+        MP4FanOutCopy copier(&file);
+        for (size_t i = 0; i < variants.size(); ++i) {
+            checkpoint.Restore();
+            SampleTable edited = table;
+            editFile(variants[i], file, 0, trackId, &edited);
+            std::fprintf(stderr, "Writing %s\n", variants[i].dst);
+            copier.addOutput(variants[i].dst);
         }
+
+        std::fprintf(stderr, "Saving MP4 streams...\n");
+        Progress progress(opt.progressFormat, opt.progressFd);
+        progress.Begin(copier.getTotalBytes(), copier.getTotalChunks());
+        while (copier.copyNextBatch())
+            progress.Update(copier.getCopiedBytes(),
+                            copier.getCopiedChunks());
+        copier.finish();
+        progress.Finish();
         std::fprintf(stderr, "\nOperation completed with no problem\n");
     } catch (mp4v2::impl::Exception *e) {
         handle_mp4error(e);
     }
 }
 
+/*
+ * Reads the input from an http:// URL with range requests.
+ */
+void executeHttp(Option &opt)
+{
+    HttpReader input(opt.src);
+    opt.srcCallbacks = HttpReader::Callbacks();
+    opt.srcHandle = &input;
+    if (opt.variants.size())
+        executeFanOut(opt);
+    else if (opt.directIO)
+        executeDirect(opt);
+    else
+        execute(opt);
+    std::fprintf(stderr, "Fetched %llu of %llu bytes in %llu requests\n",
+                 static_cast<unsigned long long>(input.BytesReceived()),
+                 static_cast<unsigned long long>(input.Size()),
+                 static_cast<unsigned long long>(input.Requests()));
+}
+
 const char *getversion();
 
 void usage()
@@ -421,7 +266,11 @@ void usage()
 "mp4fpsmod %s\n"
 "(libmp4v2 " MP4V2_PROJECT_version ")\n"
 "usage: mp4fpsmod [options] FILE\n"
+"       mp4fpsmod --serve <socket> [--jobs <n>]\n"
+"  FILE can be an http:// URL, read with range requests.\n"
 "  -o <file>             Specify MP4 output filename.\n"
+"                        \"-\" as FILE or output streams from stdin / to\n"
+"                        stdout; the input must have moov before mdat.\n"
 "  -i, --inplace         Edit in-place instead of creating a new file.\n"
 "  -p, --print <file>    Output current timecodes into timecode-v2 format.\n"
 "  -t, --tcfile <file>   Edit timecodes with timecode-v2 file.\n"
@@ -443,10 +292,55 @@ void usage()
 "  -A, --static-audio-timedelta <n>\n"
 "                        Make timedelta of audio track static.\n"
 "                        Also modify video timestamps to keep them in sync\n"
+"  --max-deviation <ms>  Rewrite the timecodes into runs of a constant\n"
+"                        frame duration, each as long as the bound allows,\n"
+"                        moving no frame by more than ms milliseconds.\n"
+"  -j, --threads <n>     Parse tracks on n threads (0: one per CPU).\n"
+"  --copy-threads <n>    Copy mdat on n threads, each writing its own byte\n"
+"                        range of the output (0: one per CPU).\n"
+"  --journal <file>      Checkpoint the copy in <file>. If the copy is\n"
+"                        interrupted, running the same command again\n"
+"                        resumes it. Removed once the copy completes.\n"
+"  --index-cache <file>  Keep the decoded sample table of the input in\n"
+"                        <file>, so that reruns skip decoding it and -p\n"
+"                        skips parsing the input.\n"
+"  --in-memory           Read the whole input into memory and build the\n"
+"                        output there, writing it out in one go.\n"
+"  --direct-io           Write the output with direct I/O (O_DIRECT),\n"
+"                        keeping mdat out of the page cache.\n"
+"  --and                 Start the options of one more output: -o, -t, -x,\n"
+"                        -r, -c, -d, -T, -A and --max-deviation given\n"
+"                        after it apply to that output only. All of them\n"
+"                        are written from one parse of FILE, reading its\n"
+"                        media data once.\n"
+"  --serve <socket>      Run jobs sent to the Unix-domain socket <socket>:\n"
+"                        one argument per line, ended by an empty line.\n"
+"                        Progress and the outcome are sent back as JSON.\n"
+"                        Paths in a job must be absolute.\n"
+"  --jobs <n>            Run up to n jobs at a time (0: one per CPU).\n"
+"  --progress <text|json|none>\n"
+"                        Format of the progress report while writing.\n"
+"                        json emits one object per line with bytes/s and ETA.\n"
+"  --progress-fd <n>     Write progress reports to file descriptor n\n"
+"                        (default: 2, stderr).\n"
     , getversion());
     std::exit(1);
 }
 
+enum {
+    OPT_PROGRESS = 0x100,
+    OPT_PROGRESS_FD,
+    OPT_IN_MEMORY,
+    OPT_DIRECT_IO,
+    OPT_COPY_THREADS,
+    OPT_JOURNAL,
+    OPT_INDEX_CACHE,
+    OPT_SERVE,
+    OPT_JOBS,
+    OPT_AND,
+    OPT_MAX_DEVIATION
+};
+
 static struct option long_options[] = {
     { "inplace", no_argument, 0, 'i' },
     { "print", required_argument, 0, 'p' },
@@ -457,69 +351,289 @@ static struct option long_options[] = {
     { "compress-dts", no_argument, 0, 'c' },
     { "keep-timescale", no_argument, 0, 'k' },
     { "timescale", required_argument, 0, 'T' },
+    { "progress", required_argument, 0, OPT_PROGRESS },
+    { "progress-fd", required_argument, 0, OPT_PROGRESS_FD },
+    { "in-memory", no_argument, 0, OPT_IN_MEMORY },
+    { "direct-io", no_argument, 0, OPT_DIRECT_IO },
+    { "threads", required_argument, 0, 'j' },
+    { "copy-threads", required_argument, 0, OPT_COPY_THREADS },
+    { "journal", required_argument, 0, OPT_JOURNAL },
+    { "index-cache", required_argument, 0, OPT_INDEX_CACHE },
+    { "serve", required_argument, 0, OPT_SERVE },
+    { "jobs", required_argument, 0, OPT_JOBS },
+    { "and", no_argument, 0, OPT_AND },
+    { "max-deviation", required_argument, 0, OPT_MAX_DEVIATION },
     { 0, 0, 0, 0 }
 };
 
-int main1(int argc, char **argv)
+/*
+ * Parses the command line into option.
+ * Returns false if it does not make sense, and usage should be shown.
+ */
+bool parseOptions(int argc, char **argv, Option &option)
 {
-    try {
-        std::setbuf(stderr, 0);
-
-        Option option;
-        int ch;
+    int ch;
 
-        while ((ch = getopt_long(argc, argv, "io:p:r:t:d:T:A:xcQ",
-                        long_options, 0)) != EOF) {
-            if (ch == 'i') {
-                option.inplace = true;
-            } else if (ch == 'r') {
-                int nframes, num, denom = 1;
-                if (std::sscanf(optarg, "%d:%d/%d", &nframes, &num, &denom) < 2)
-                    usage();
-                FPSRange range = { (uint32_t)nframes, num, denom };
-                option.ranges.push_back(range);
-            } else if (ch == 'p') {
-                option.printOnly = true;
-                option.timecodeFile = optarg;
-            } else if (ch == 't') {
-                option.timecodeFile = optarg;
-            } else if (ch == 'd') {
-                int delay;
-                if (std::sscanf(optarg, "%d", &delay) != 1)
-                    usage();
-                option.audioDelay = delay;
-            } else if (ch == 'o') {
-                option.dst = optarg;
-            } else if (ch == 'x') {
-                option.optimizeTimecode = true;
-            } else if (ch == 'c') {
-                option.compressDTS = true;
-            } else if (ch == 'T') {
-                if (!std::strcmp(optarg, "keep"))
-                    option.requestedTimeScale = -1;
-                else {
-                    unsigned n;
-                    if (std::sscanf(optarg, "%u", &n) != 1)
-                        usage();
-                    option.requestedTimeScale = n;
-                }
-            } else if (ch == 'A') {
-                int delta;
-                if (std::sscanf(optarg, "%d", &delta) != 1)
-                    usage();
-                option.audioTimeDelta = delta;
+    while ((ch = getopt_long(argc, argv, "io:p:r:t:d:T:A:j:xcQ",
+                    long_options, 0)) != EOF) {
+        if (ch == 'i') {
+            option.inplace = true;
+        } else if (ch == 'r') {
+            int nframes, num, denom = 1;
+            if (std::sscanf(optarg, "%d:%d/%d", &nframes, &num, &denom) < 2)
+                return false;
+            FPSRange range = { (uint32_t)nframes, num, denom };
+            option.ranges.push_back(range);
+        } else if (ch == 'p') {
+            option.printOnly = true;
+            option.timecodeFile = optarg;
+        } else if (ch == 't') {
+            option.timecodeFile = optarg;
+        } else if (ch == 'd') {
+            int delay;
+            if (std::sscanf(optarg, "%d", &delay) != 1)
+                return false;
+            option.audioDelay = delay;
+        } else if (ch == 'o') {
+            option.dst = optarg;
+        } else if (ch == 'x') {
+            option.optimizeTimecode = true;
+        } else if (ch == 'c') {
+            option.compressDTS = true;
+        } else if (ch == 'T') {
+            if (!std::strcmp(optarg, "keep"))
+                option.requestedTimeScale = -1;
+            else {
+                unsigned n;
+                if (std::sscanf(optarg, "%u", &n) != 1)
+                    return false;
+                option.requestedTimeScale = n;
             }
+        } else if (ch == 'A') {
+            int delta;
+            if (std::sscanf(optarg, "%d", &delta) != 1)
+                return false;
+            option.audioTimeDelta = delta;
+        } else if (ch == OPT_MAX_DEVIATION) {
+            if (std::sscanf(optarg, "%lf", &option.maxDeviation) != 1
+                    || option.maxDeviation <= 0)
+                return false;
+        } else if (ch == OPT_PROGRESS) {
+            if (!Progress::ParseFormat(optarg, &option.progressFormat))
+                return false;
+        } else if (ch == OPT_PROGRESS_FD) {
+            if (std::sscanf(optarg, "%d", &option.progressFd) != 1)
+                return false;
+        } else if (ch == 'j') {
+            if (std::sscanf(optarg, "%u", &option.threads) != 1)
+                return false;
+            if (option.threads == 0)
+                option.threads = std::thread::hardware_concurrency();
+        } else if (ch == OPT_IN_MEMORY) {
+            option.inMemory = true;
+        } else if (ch == OPT_DIRECT_IO) {
+            option.directIO = true;
+        } else if (ch == OPT_COPY_THREADS) {
+            if (std::sscanf(optarg, "%u", &option.copyThreads) != 1)
+                return false;
+            if (option.copyThreads == 0)
+                option.copyThreads = std::thread::hardware_concurrency();
+        } else if (ch == OPT_JOURNAL) {
+            option.journalFile = optarg;
+        } else if (ch == OPT_INDEX_CACHE) {
+            option.indexFile = optarg;
+        } else if (ch == OPT_SERVE) {
+            option.servePath = optarg;
+        } else if (ch == OPT_JOBS) {
+            if (std::sscanf(optarg, "%u", &option.jobs) != 1)
+                return false;
+        } else if (ch == OPT_AND) {
+            option.variants.push_back(Option());
+            option.variants.back().setEdits(option);
+            option.setEdits(Option());
+        }
+    }
+    if (option.variants.size()) {
+        option.variants.push_back(Option());
+        option.variants.back().setEdits(option);
+        option.setEdits(Option());
+    }
+    argc -= optind;
+    argv += optind;
+    if (option.servePath)
+        return argc == 0;
+    if (argc == 0 || (!option.printOnly && !option.inplace && !option.dst
+                      && option.variants.empty()))
+        return false;
+    option.src = argv[0];
+    return true;
+}
+
+/*
+ * Returns why the options cannot be used together, or 0 if they can.
+ */
+const char *checkOptions(const Option &option)
+{
+    if (!option.printOnly && option.timecodeFile && option.ranges.size())
+        return "-t and -r are exclusive";
+    bool streaming = StreamReader::isStdio(option.src)
+        || (option.dst && StreamReader::isStdio(option.dst));
+    if (streaming && (option.inplace || option.inMemory))
+        return "-i and --in-memory cannot be used with \"-\"";
+    if (option.directIO
+            && (streaming || option.inplace || option.inMemory))
+        return "--direct-io cannot be used with -i, --in-memory or \"-\"";
+    if (option.copyThreads > 1 && (streaming || option.inplace
+                || option.inMemory || option.directIO))
+        return "--copy-threads cannot be used with -i, "
+               "--in-memory, --direct-io or \"-\"";
+    if (option.journalFile && (streaming || option.inplace
+                || option.inMemory || option.directIO))
+        return "--journal cannot be used with -i, "
+               "--in-memory, --direct-io or \"-\"";
+    if (HttpReader::IsURL(option.src) && (streaming || option.inplace
+                || option.inMemory || option.copyThreads > 1
+                || option.journalFile))
+        return "An http:// input cannot be used with -i, "
+               "--in-memory, --copy-threads, --journal or \"-\"";
+    if (option.indexFile && (StreamReader::isStdio(option.src)
+                || HttpReader::IsURL(option.src)))
+        return "--index-cache cannot be used with an http:// or \"-\" input";
+    if (option.variants.size()) {
+        if (option.printOnly || option.inplace || option.inMemory
+                || option.directIO || option.copyThreads > 1
+                || option.journalFile || StreamReader::isStdio(option.src))
+            return "--and cannot be used with -p, -i, --in-memory, "
+                   "--direct-io, --copy-threads, --journal or \"-\"";
+        for (size_t i = 0; i < option.variants.size(); ++i) {
+            const Option &variant = option.variants[i];
+            if (!variant.dst)
+                return "Each output of --and needs -o";
+            if (StreamReader::isStdio(variant.dst))
+                return "--and cannot be used with \"-\"";
+            if (variant.timecodeFile && variant.ranges.size())
+                return "-t and -r are exclusive";
         }
-        argc -= optind;
-        argv += optind;
-        if (argc == 0 || (!option.printOnly && !option.inplace && !option.dst))
+    }
+    return 0;
+}
+
+void run(Option &option)
+{
+    if (option.variants.size() && !HttpReader::IsURL(option.src))
+        executeFanOut(option);
+    else if (StreamReader::isStdio(option.src)
+            || (option.dst && StreamReader::isStdio(option.dst)))
+        executeStream(option);
+    else if (HttpReader::IsURL(option.src))
+        executeHttp(option);
+    else if (option.inMemory)
+        executeInMemory(option);
+    else if (option.directIO)
+        executeDirect(option);
+    else
+        execute(option);
+}
+
+#if !defined(_WIN32)
+/*
+ * A job is run in the server's working directory, which the client
+ * knows nothing about: returns the first path that is not absolute.
+ */
+const char *relativePath(const Option &option)
+{
+    const char *paths[] = {
+        HttpReader::IsURL(option.src) ? 0 : option.src, option.dst,
+        option.timecodeFile, option.journalFile, option.indexFile
+    };
+    for (size_t i = 0; i < sizeof paths / sizeof paths[0]; ++i)
+        if (paths[i] && paths[i][0] != '/')
+            return paths[i];
+    for (size_t i = 0; i < option.variants.size(); ++i)
+        if (const char *path = relativePath(option.variants[i]))
+            return path;
+    return 0;
+}
+
+/*
+ * Runs one job of --serve: args is a command line without the program
+ * name. Progress and the outcome are reported to fd as JSON lines.
+ */
+void runJob(const std::vector<std::string> &args, int fd)
+{
+    static std::mutex getoptMutex;
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>("mp4fpsmod"));
+    for (size_t i = 0; i < args.size(); ++i)
+        argv.push_back(const_cast<char*>(args[i].c_str()));
+    argv.push_back(0);
+
+    Option option;
+    option.progressFormat = Progress::FORMAT_JSON;
+    bool parsed;
+    {
+        /* getopt keeps its state in globals */
+        std::lock_guard<std::mutex> lock(getoptMutex);
+#if defined(__GLIBC__)
+        optind = 0;
+#else
+        optind = 1;
+#endif
+        parsed = parseOptions(argv.size() - 1, &argv[0], option);
+    }
+    /* whatever the job says, its progress goes back to the client */
+    option.progressFd = fd;
+    Progress report(Progress::FORMAT_JSON, fd);
+    const char *error = 0;
+    if (!parsed || option.servePath)
+        error = "Invalid arguments";
+    else if (!(error = checkOptions(option))
+            && (StreamReader::isStdio(option.src)
+                || (option.dst && StreamReader::isStdio(option.dst))
+                || (option.printOnly
+                    && !std::strcmp(option.timecodeFile, "-"))))
+        error = "\"-\" cannot be used in a job";
+    else if (!error && relativePath(option))
+        error = "Paths in a job must be absolute";
+    if (error) {
+        report.Message("error", error);
+        return;
+    }
+    try {
+        run(option);
+        report.Message("result", "ok");
+    } catch (const std::exception &e) {
+        report.Message("error", e.what());
+    }
+}
+#endif
+
+int main1(int argc, char **argv)
+{
+    try {
+        Option option;
+        if (!parseOptions(argc, argv, option))
             usage();
-        if (!option.printOnly && option.timecodeFile && option.ranges.size()) {
-            fprintf(stderr, "-t and -r are exclusive\n");
+        if (option.servePath) {
+#if defined(_WIN32)
+            std::fprintf(stderr, "--serve is not supported on Windows\n");
             return 1;
+#else
+            unsigned jobs = option.jobs;
+            if (jobs == 0)
+                jobs = std::thread::hardware_concurrency();
+            JobServer server(option.servePath, jobs, runJob);
+            std::fprintf(stderr, "Serving on %s with %u job%s\n",
+                         option.servePath, jobs, jobs == 1 ? "" : "s");
+            server.Run();
+            return 0;
+#endif
         }
-        option.src = argv[0];
-        execute(option);
+        if (const char *error = checkOptions(option)) {
+            fprintf(stderr, "%s\n", error);
+            return 1;
+        }
+        run(option);
         return 0;
     } catch (const std::exception &e) {
         std::fprintf(stderr, "%s\n", e.what());
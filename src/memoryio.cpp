@@ -0,0 +1,131 @@
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <stdexcept>
+#include "memoryio.h"
+#include "mp4v2wrapper.h"
+
+using mp4v2::platform::io::File;
+
+const MP4IOCallbacks *MemoryReader::Callbacks()
+{
+    static const MP4IOCallbacks callbacks = {
+        size, seek, read, write, 0
+    };
+    return &callbacks;
+}
+
+int64_t MemoryReader::size(void *handle)
+{
+    return static_cast<MemoryReader*>(handle)->m_size;
+}
+
+int MemoryReader::seek(void *handle, int64_t pos)
+{
+    MemoryReader *self = static_cast<MemoryReader*>(handle);
+    if (pos < 0 || static_cast<uint64_t>(pos) > self->m_size)
+        return 1;
+    self->m_pos = pos;
+    return 0;
+}
+
+int MemoryReader::read(void *handle, void *buffer, int64_t size, int64_t *nin)
+{
+    MemoryReader *self = static_cast<MemoryReader*>(handle);
+    uint64_t n = std::min<uint64_t>(size, self->m_size - self->m_pos);
+    std::memcpy(buffer, self->m_data + self->m_pos, n);
+    self->m_pos += n;
+    *nin = n;
+    return 0;
+}
+
+int MemoryReader::write(void *, const void *, int64_t, int64_t *)
+{
+    return 1;
+}
+
+const MP4IOCallbacks *MemorySink::Callbacks()
+{
+    static const MP4IOCallbacks callbacks = {
+        size, seek, read, write, truncate
+    };
+    return &callbacks;
+}
+
+int64_t MemorySink::size(void *handle)
+{
+    return static_cast<MemorySink*>(handle)->m_data.size();
+}
+
+int MemorySink::seek(void *handle, int64_t pos)
+{
+    if (pos < 0)
+        return 1;
+    static_cast<MemorySink*>(handle)->m_pos = pos;
+    return 0;
+}
+
+int MemorySink::read(void *handle, void *buffer, int64_t size, int64_t *nin)
+{
+    MemorySink *self = static_cast<MemorySink*>(handle);
+    uint64_t avail = self->m_pos < self->m_data.size()
+                   ? self->m_data.size() - self->m_pos : 0;
+    uint64_t n = std::min<uint64_t>(size, avail);
+    if (n)
+        std::memcpy(buffer, &self->m_data[self->m_pos], n);
+    self->m_pos += n;
+    *nin = n;
+    return 0;
+}
+
+int MemorySink::write(void *handle, const void *buffer, int64_t size,
+                      int64_t *nout)
+{
+    MemorySink *self = static_cast<MemorySink*>(handle);
+    uint64_t end = self->m_pos + size;
+    try {
+        if (end > self->m_data.size())
+            self->m_data.resize(end);
+    } catch (const std::bad_alloc &) {
+        return 1;
+    }
+    if (size)
+        std::memcpy(&self->m_data[self->m_pos], buffer, size);
+    self->m_pos = end;
+    *nout = size;
+    return 0;
+}
+
+int MemorySink::truncate(void *handle, int64_t size)
+{
+    if (size < 0)
+        return 1;
+    static_cast<MemorySink*>(handle)->m_data.resize(size);
+    return 0;
+}
+
+void MemorySink::Load(const char *path)
+{
+    File file(path, File::MODE_READ);
+    if (file.open())
+        throw std::runtime_error(std::string("cannot open ") + path);
+    m_data.resize(file.size);
+    File::Size nin = 0;
+    bool failed = m_data.size() && file.read(&m_data[0], m_data.size(), nin);
+    file.close();
+    if (failed || nin != File::Size(m_data.size()))
+        throw std::runtime_error(std::string("cannot read ") + path);
+    m_pos = 0;
+}
+
+void MemorySink::Save(const char *path) const
+{
+    File file(path, File::MODE_CREATE);
+    if (file.open())
+        throw std::runtime_error(std::string("cannot create ") + path);
+    File::Size nout = 0;
+    bool failed = m_data.size()
+               && file.write(&m_data[0], m_data.size(), nout);
+    if (file.close() || failed || nout != File::Size(m_data.size()))
+        throw std::runtime_error(std::string("cannot write ") + path);
+}
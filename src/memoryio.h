@@ -0,0 +1,62 @@
+#ifndef MEMORYIO_H
+#define MEMORYIO_H
+
+#include <stdint.h>
+#include <vector>
+#include "mp4v2/mp4v2.h"
+
+/*
+ * In-memory backends for MP4IOCallbacks, so that mp4v2 can parse from
+ * and write into RAM without going through a temporary file.
+ *
+ * MemoryReader reads from a caller-owned buffer, which must outlive it
+ * and is never copied or written to.
+ * MemorySink is a growable, seekable buffer; mp4v2 seeks back to patch
+ * atom sizes while writing, so a plain append-only stream is not enough.
+ * It is readable as well, which makes it usable for in-place editing.
+ */
+class MemoryReader {
+    const uint8_t *m_data;
+    uint64_t m_size;
+    uint64_t m_pos;
+public:
+    MemoryReader(const void *data, uint64_t size)
+        : m_data(static_cast<const uint8_t*>(data)), m_size(size), m_pos(0)
+    {}
+    const uint8_t *Data() const { return m_data; }
+    uint64_t Size() const { return m_size; }
+
+    static const MP4IOCallbacks *Callbacks();
+private:
+    static int64_t size(void *handle);
+    static int seek(void *handle, int64_t pos);
+    static int read(void *handle, void *buffer, int64_t size, int64_t *nin);
+    static int write(void *handle, const void *buffer, int64_t size,
+                     int64_t *nout);
+};
+
+class MemorySink {
+    std::vector<uint8_t> m_data;
+    uint64_t m_pos;
+public:
+    MemorySink(): m_pos(0) {}
+    void Reserve(uint64_t size) { m_data.reserve(size); }
+    const uint8_t *Data() const { return m_data.empty() ? 0 : &m_data[0]; }
+    uint64_t Size() const { return m_data.size(); }
+    std::vector<uint8_t> &Buffer() { return m_data; }
+
+    /* whole-file transfer through mp4v2's platform I/O layer */
+    void Load(const char *path);
+    void Save(const char *path) const;
+
+    static const MP4IOCallbacks *Callbacks();
+private:
+    static int64_t size(void *handle);
+    static int seek(void *handle, int64_t pos);
+    static int read(void *handle, void *buffer, int64_t size, int64_t *nin);
+    static int write(void *handle, const void *buffer, int64_t size,
+                     int64_t *nout);
+    static int truncate(void *handle, int64_t size);
+};
+
+#endif
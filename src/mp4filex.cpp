@@ -1,4 +1,9 @@
+#include <chrono>
+#include <cstring>
+#include <algorithm>
 #include "mp4filex.h"
+#include "mp4trackx.h"
+#include "journal.h"
 
 using mp4v2::impl::MP4File;
 using mp4v2::impl::MP4Track;
@@ -11,6 +16,15 @@ MP4FileCopy::MP4FileCopy(MP4File *file)
           m_dst(0)
 {
     m_nchunks = 0;
+    m_totalBytes = 0;
+    m_copiedBytes = 0;
+    m_copiedChunks = 0;
+    m_running = 0;
+    m_abort = false;
+    m_layout = 0;
+    m_dataEnd = 0;
+    m_journal = 0;
+    m_resume = false;
     size_t numTracks = file->GetNumberOfTracks();
     for (size_t i = 0; i < numTracks; ++i) {
         ChunkInfo ci;
@@ -19,17 +33,55 @@ MP4FileCopy::MP4FileCopy(MP4File *file)
         ci.time = MP4_INVALID_TIMESTAMP;
         m_state.push_back(ci);
         m_nchunks += ci.final;
+        m_totalBytes += m_mp4file->m_pTracks[i]->GetTotalOfSampleSizes();
     }
 }
 
-void MP4FileCopy::start(const char *path)
+/*
+ * Only gets here with m_dst set when the copy failed, possibly while an
+ * exception unwinds: close the output as it is rather than writing moov,
+ * which might throw again.
+ */
+MP4FileCopy::~MP4FileCopy()
+{
+    m_abort = true;
+    joinWorkers();
+    if (m_dst) {
+        delete m_dst;
+        m_dst = 0;
+        m_mp4file->m_file = m_src;
+    }
+}
+
+void MP4FileCopy::start(const char *path, bool resume)
+{
+    m_resume = resume;
+    m_mp4file->m_file = 0;
+    m_mp4file->Open(path, resume ? File::MODE_MODIFY : File::MODE_CREATE, 0);
+    beginWrite();
+}
+
+void MP4FileCopy::start(const MP4IOCallbacks *callbacks, void *handle)
 {
     m_mp4file->m_file = 0;
-    m_mp4file->Open(path, File::MODE_CREATE, 0);
+    m_mp4file->Open(0, File::MODE_CREATE, 0, callbacks, handle);
+    beginWrite();
+}
+
+void MP4FileCopy::beginWrite()
+{
     m_dst = m_mp4file->m_file;
     m_mp4file->SetIntegerProperty("moov.mvhd.modificationTime",
         mp4v2::impl::MP4GetAbsTimestamp());
     dynamic_cast<MP4RootAtom*>(m_mp4file->m_pRootAtom)->BeginOptimalWrite();
+    /*
+     * All that is left to write is the mdat payload, whose size is known:
+     * reserve the space in one go, and tell both ends that the data is
+     * passed through once, so that it needn't stay cached.
+     */
+    m_dst->preallocate(m_dst->position + m_totalBytes);
+    m_dst->setStreaming(true);
+    m_src->setStreaming(true);
 }
 
 void MP4FileCopy::finish()
@@ -39,6 +91,9 @@ void MP4FileCopy::finish()
     try {
         MP4RootAtom *root = dynamic_cast<MP4RootAtom*>(m_mp4file->m_pRootAtom);
         root->FinishOptimalWrite();
+        /* what an earlier run left beyond the end */
+        if (m_resume && m_dst->truncate(m_dataEnd))
+            throw std::runtime_error("cannot truncate " + m_dst->name);
     } catch (...) {
         delete m_dst;
         m_dst = 0;
@@ -50,9 +105,10 @@ void MP4FileCopy::finish()
     m_mp4file->m_file = m_src;
 }
 
-bool MP4FileCopy::copyNextChunk()
+/* track holding the next chunk in time order, or -1 when all are done */
+int MP4FileCopy::nextTrack()
 {
-    uint32_t nextTrack = -1;
+    int nextTrack = -1;
     MP4Timestamp nextTime = MP4_INVALID_TIMESTAMP;
     size_t numTracks = m_mp4file->GetNumberOfTracks();
     for (size_t i = 0; i < numTracks; ++i) {
@@ -72,6 +128,12 @@ bool MP4FileCopy::copyNextChunk()
         nextTime = m_state[i].time;
         nextTrack = i;
     }
+    return nextTrack;
+}
+
+bool MP4FileCopy::copyNextChunk()
+{
+    int nextTrack = this->nextTrack();
     if (nextTrack == -1) return false;
     MP4Track *track = m_mp4file->m_pTracks[nextTrack];
     m_mp4file->m_file = m_src;
@@ -81,7 +143,409 @@ bool MP4FileCopy::copyNextChunk()
     m_mp4file->m_file = m_dst;
     track->RewriteChunk(m_state[nextTrack].current, chunk, size);
     MP4Free(chunk);
+    m_copiedBytes += size;
+    ++m_copiedChunks;
     m_state[nextTrack].current++;
     m_state[nextTrack].time = MP4_INVALID_TIMESTAMP;
     return true;
 }
+
+/*
+ * Lays out all chunks in the order copyNextChunk() would write them,
+ * and points the chunk offsets of moov to their final place.
+ * m_layout identifies the layout, for the journal.
+ */
+void MP4FileCopy::plan()
+{
+    uint64_t offset = m_mp4file->GetPosition();
+    uint64_t srcSize = m_src->size;
+    m_layout = CopyJournal::Hash(&srcSize, sizeof srcSize);
+    int i;
+    while ((i = nextTrack()) != -1) {
+        MP4TrackX *track = reinterpret_cast<MP4TrackX*>(m_mp4file->m_pTracks[i]);
+        mp4v2::impl::MP4ChunkId chunkId = m_state[i].current;
+        PlannedChunk chunk;
+        chunk.srcOffset = track->ChunkOffsetProperty()->GetValue(chunkId - 1);
+        chunk.dstOffset = offset;
+        chunk.size = track->GetChunkSizeX(chunkId);
+        chunk.done = false;
+        track->ChunkOffsetProperty()->SetValue(offset, chunkId - 1);
+        m_layout = CopyJournal::Hash(&chunk.srcOffset, sizeof chunk.srcOffset,
+                                     m_layout);
+        m_layout = CopyJournal::Hash(&chunk.size, sizeof chunk.size, m_layout);
+        m_plan.push_back(chunk);
+        offset += chunk.size;
+        m_state[i].current++;
+        m_state[i].time = MP4_INVALID_TIMESTAMP;
+    }
+    m_layout = CopyJournal::Hash(&offset, sizeof offset, m_layout);
+    m_dataEnd = offset;
+    /* FinishOptimalWrite() takes the end of mdat from the position */
+    m_mp4file->SetPosition(offset);
+}
+
+/*
+ * Copies m_plan[begin, end), which is contiguous in the output, in batches:
+ * the chunks of a batch are read straight to their place in the batch
+ * buffer with one scatter read per run of chunks that are adjacent in the
+ * input, and the batch goes out with a single write. Chunks done by an
+ * earlier run are skipped.
+ */
+void MP4FileCopy::copyRange(size_t begin, size_t end)
+{
+    File src(m_src->name, File::MODE_READ);
+    File dst(m_dst->name, File::MODE_MODIFY);
+    if (src.open())
+        throw std::runtime_error("cannot open " + src.name);
+    if (dst.open())
+        throw std::runtime_error("cannot open " + dst.name);
+    src.setStreaming(true);
+    dst.setStreaming(true);
+    std::vector<uint8_t> buffer;
+    std::vector<size_t> order;
+    std::vector<File::Segment> segments;
+    uint64_t written = 0;   // by the current run of copied chunks
+    uint64_t unsynced = 0;
+    while (begin < end && !m_abort) {
+        if (m_plan[begin].done) {
+            if (written)
+                checkpoint(dst, dst.position - written);
+            written = unsynced = 0;
+            ++begin;
+            continue;
+        }
+        uint64_t base = m_plan[begin].dstOffset;
+        if (!written && dst.seek(base))
+            throw std::runtime_error("seek error on " + dst.name);
+        size_t last = begin + 1;
+        while (last < end && !m_plan[last].done
+               && m_plan[last].dstOffset + m_plan[last].size - base
+                  <= BATCH_SIZE)
+            ++last;
+        uint64_t size = m_plan[last - 1].dstOffset + m_plan[last - 1].size
+                      - base;
+        if (buffer.size() < size)
+            buffer.resize(size);
+
+        order.clear();
+        for (size_t i = begin; i < last; ++i)
+            order.push_back(i);
+        std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+            return m_plan[a].srcOffset < m_plan[b].srcOffset;
+        });
+        for (size_t k = 0; k < order.size(); ) {
+            const PlannedChunk &first = m_plan[order[k]];
+            uint64_t next = first.srcOffset;
+            File::Size runSize = 0;
+            segments.clear();
+            for (; k < order.size() && m_plan[order[k]].srcOffset == next; ++k) {
+                const PlannedChunk &chunk = m_plan[order[k]];
+                File::Segment segment = {
+                    &buffer[0] + (chunk.dstOffset - base), chunk.size
+                };
+                segments.push_back(segment);
+                next += chunk.size;
+                runSize += chunk.size;
+            }
+            File::Size n;
+            if (src.seek(first.srcOffset)
+                    || src.readv(&segments[0], segments.size(), n)
+                    || n != runSize)
+                throw std::runtime_error("read error on " + src.name);
+        }
+        File::Size n;
+        if (size && (dst.write(&buffer[0], size, n) || n != File::Size(size)))
+            throw std::runtime_error("write error on " + dst.name);
+        m_copiedBytes += size;
+        m_copiedChunks += last - begin;
+        begin = last;
+        written += size;
+        unsynced += size;
+        if (unsynced >= CHECKPOINT_SIZE) {
+            checkpoint(dst, dst.position - written);
+            unsynced = 0;
+        }
+    }
+    if (written && !m_abort)
+        checkpoint(dst, dst.position - written);
+    if (dst.close())
+        throw std::runtime_error("write error on " + dst.name);
+}
+
+/* makes what was written from start on durable, and journals it */
+void MP4FileCopy::checkpoint(File &dst, uint64_t start)
+{
+    if (!m_journal)
+        return;
+    if (dst.sync())
+        throw std::runtime_error("write error on " + dst.name);
+    m_journal->Record(start, dst.position);
+}
+
+const std::vector<MP4FileCopy::PlannedChunk> &MP4FileCopy::layOut()
+{
+    plan();
+    finish();
+    return m_plan;
+}
+
+void MP4FileCopy::startParallel(unsigned threads)
+{
+    plan();
+    if (m_plan.empty())
+        return;
+    if (m_journal && m_journal->Open(m_layout, m_resume)) {
+        for (size_t i = 0; i < m_plan.size(); ++i) {
+            PlannedChunk &chunk = m_plan[i];
+            chunk.done = m_journal->IsDone(chunk.dstOffset,
+                                           chunk.dstOffset + chunk.size);
+            if (chunk.done) {
+                m_copiedBytes += chunk.size;
+                ++m_copiedChunks;
+            }
+        }
+    }
+    uint64_t base = m_plan.front().dstOffset;
+    uint64_t total = m_plan.back().dstOffset + m_plan.back().size - base;
+    threads = std::max(1u, threads);
+
+    /* split at chunk boundaries into ranges of about the same size */
+    std::vector<std::pair<size_t, size_t> > ranges;
+    size_t begin = 0;
+    for (unsigned k = 1; k <= threads && begin < m_plan.size(); ++k) {
+        uint64_t limit = total * k / threads;
+        size_t end = begin + 1;
+        while (end < m_plan.size()
+               && (k == threads || m_plan[end].dstOffset - base < limit))
+            ++end;
+        ranges.push_back(std::make_pair(begin, end));
+        begin = end;
+    }
+
+    m_running = ranges.size();
+    for (size_t k = 0; k < ranges.size(); ++k) {
+        size_t first = ranges[k].first, last = ranges[k].second;
+        m_workers.push_back(std::thread([this, first, last]() {
+            try {
+                copyRange(first, last);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_error)
+                    m_error = std::current_exception();
+                m_abort = true;
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_running == 0)
+                m_done.notify_all();
+        }));
+    }
+}
+
+bool MP4FileCopy::waitParallel(unsigned milliseconds)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!m_done.wait_for(lock, std::chrono::milliseconds(milliseconds),
+                             [this]() { return m_running == 0; }))
+            return true;
+    }
+    joinWorkers();
+    if (m_error) {
+        std::exception_ptr error = m_error;
+        m_error = std::exception_ptr();
+        std::rethrow_exception(error);
+    }
+    return false;
+}
+
+void MP4FileCopy::joinWorkers()
+{
+    for (size_t i = 0; i < m_workers.size(); ++i)
+        m_workers[i].join();
+    m_workers.clear();
+}
+
+MP4FanOutCopy::MP4FanOutCopy(MP4File *file)
+        : m_mp4file(reinterpret_cast<MP4FileX*>(file))
+{
+    m_next = 0;
+    m_clock = 0;
+    m_totalChunks = 0;
+    m_totalBytes = 0;
+    m_copiedBytes = 0;
+    m_copiedChunks = 0;
+    size_t numTracks = file->GetNumberOfTracks();
+    for (size_t i = 0; i < numTracks; ++i) {
+        MP4TrackX *track = reinterpret_cast<MP4TrackX*>(m_mp4file->m_pTracks[i]);
+        std::vector<uint64_t> offsets;
+        uint32_t nchunks = track->GetNumberOfChunks();
+        for (uint32_t j = 0; j < nchunks; ++j)
+            offsets.push_back(track->ChunkOffsetProperty()->GetValue(j));
+        m_offsets.push_back(offsets);
+    }
+}
+
+MP4FanOutCopy::~MP4FanOutCopy()
+{
+    for (size_t i = 0; i < m_outputs.size(); ++i)
+        delete m_outputs[i].file;
+}
+
+void MP4FanOutCopy::addOutput(const char *path)
+{
+    Output output;
+    output.path = path;
+    output.file = 0;
+    {
+        MP4FileCopy copier(m_mp4file);
+        copier.start(path);
+        output.plan = copier.layOut();
+    }
+    for (size_t i = 0; i < m_offsets.size(); ++i) {
+        MP4TrackX *track = reinterpret_cast<MP4TrackX*>(m_mp4file->m_pTracks[i]);
+        for (size_t j = 0; j < m_offsets[i].size(); ++j)
+            track->ChunkOffsetProperty()->SetValue(m_offsets[i][j], j);
+    }
+    /*
+     * Line the plans up by input position. Chunks that only tie on that
+     * hold the same bytes, so that it doesn't matter which goes where.
+     */
+    std::sort(output.plan.begin(), output.plan.end(),
+              [](const PlannedChunk &a, const PlannedChunk &b) {
+        return a.srcOffset < b.srcOffset
+            || (a.srcOffset == b.srcOffset && a.size < b.size);
+    });
+    if (m_outputs.empty()) {
+        m_totalChunks = output.plan.size();
+        for (size_t i = 0; i < output.plan.size(); ++i)
+            m_totalBytes += output.plan[i].size;
+    }
+    output.file = new File(output.path, File::MODE_MODIFY);
+    m_outputs.push_back(output);
+    if (m_outputs.back().file->open())
+        throw std::runtime_error("cannot open " + output.path);
+}
+
+bool MP4FanOutCopy::copyNextBatch()
+{
+    if (m_outputs.empty() || m_next == m_outputs[0].plan.size())
+        return false;
+    const std::vector<PlannedChunk> &source = m_outputs[0].plan;
+    File *src = m_mp4file->m_file;
+    size_t begin = m_next, end = begin;
+    uint64_t size = 0;
+    while (end < source.size()
+           && (end == begin || size + source[end].size <= BATCH_SIZE))
+        size += source[end++].size;
+    if (m_buffer.size() < size)
+        m_buffer.resize(size);
+
+    /* the batch is the chunks back to back, in input order */
+    uint64_t pos = 0;
+    for (size_t i = begin; i < end; ) {
+        uint64_t run = source[i].size;
+        size_t j = i + 1;
+        for (; j < end && source[j].srcOffset
+                          == source[j - 1].srcOffset + source[j - 1].size; ++j)
+            run += source[j].size;
+        File::Size n;
+        if (run && (src->seek(source[i].srcOffset)
+                    || src->read(&m_buffer[pos], run, n) || n != File::Size(run)))
+            throw std::runtime_error("read error on " + src->name);
+        pos += run;
+        i = j;
+    }
+    for (size_t k = 0; k < m_outputs.size(); ++k) {
+        const std::vector<PlannedChunk> &plan = m_outputs[k].plan;
+        pos = 0;
+        for (size_t i = begin; i < end; ++i) {
+            stage(m_outputs[k], plan[i].dstOffset, &m_buffer[pos],
+                  plan[i].size);
+            pos += plan[i].size;
+        }
+    }
+    m_copiedBytes += size;
+    m_copiedChunks += end - begin;
+    m_next = end;
+    return true;
+}
+
+void MP4FanOutCopy::stage(Output &output, uint64_t offset,
+                          const uint8_t *data, uint64_t size)
+{
+    while (size) {
+        uint64_t base = offset / WINDOW_SIZE * WINDOW_SIZE;
+        uint64_t n = std::min(size, base + WINDOW_SIZE - offset);
+        Window *window = 0;
+        for (size_t i = 0; i < output.windows.size() && !window; ++i)
+            if (output.windows[i].filled && output.windows[i].base == base)
+                window = &output.windows[i];
+        if (!window && output.windows.size() < WINDOWS) {
+            output.windows.push_back(Window());
+            window = &output.windows.back();
+            window->filled = 0;
+            window->data.resize(WINDOW_SIZE);
+        } else if (!window) {
+            window = &output.windows[0];
+            for (size_t i = 1; i < output.windows.size(); ++i)
+                if (output.windows[i].lastUse < window->lastUse)
+                    window = &output.windows[i];
+            flush(output, *window);
+        }
+        window->base = base;
+        window->lastUse = ++m_clock;
+
+        uint32_t begin = offset - base, end = begin + n;
+        std::memcpy(&window->data[begin], data, n);
+        std::vector<std::pair<uint32_t, uint32_t> > &runs = window->runs;
+        std::vector<std::pair<uint32_t, uint32_t> >::iterator it =
+            std::lower_bound(runs.begin(), runs.end(),
+                             std::make_pair(begin, end));
+        if (it != runs.begin() && (it - 1)->second == begin) {
+            --it;
+            it->second = end;
+        } else
+            it = runs.insert(it, std::make_pair(begin, end));
+        if (it + 1 != runs.end() && (it + 1)->first == it->second) {
+            it->second = (it + 1)->second;
+            runs.erase(it + 1);
+        }
+        window->filled += n;
+        if (window->filled == WINDOW_SIZE)
+            flush(output, *window);
+
+        offset += n;
+        data += n;
+        size -= n;
+    }
+}
+
+void MP4FanOutCopy::flush(Output &output, Window &window)
+{
+    File *dst = output.file;
+    for (size_t i = 0; i < window.runs.size(); ++i) {
+        uint32_t begin = window.runs[i].first, end = window.runs[i].second;
+        File::Size n;
+        if (dst->seek(window.base + begin)
+                || dst->write(&window.data[begin], end - begin, n)
+                || n != File::Size(end - begin))
+            throw std::runtime_error("write error on " + dst->name);
+    }
+    window.runs.clear();
+    window.filled = 0;
+    window.lastUse = 0;
+}
+
+void MP4FanOutCopy::finish()
+{
+    for (size_t i = 0; i < m_outputs.size(); ++i) {
+        for (size_t j = 0; j < m_outputs[i].windows.size(); ++j)
+            flush(m_outputs[i], m_outputs[i].windows[j]);
+        File *file = m_outputs[i].file;
+        m_outputs[i].file = 0;
+        bool failed = file->close();
+        delete file;
+        if (failed)
+            throw std::runtime_error("write error on " + m_outputs[i].path);
+    }
+}
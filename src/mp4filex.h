@@ -1,31 +1,172 @@
 #ifndef _MP4FILEX
 #define _MP4FILEX
 
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
 #include "mp4v2wrapper.h"
 
 class MP4FileCopy;
+class CopyJournal;
 
 class MP4FileX: public mp4v2::impl::MP4File {
     friend class MP4FileCopy;
+    friend class MP4FanOutCopy;
 };
 
+/*
+ * Copies the media data of a parsed file into a new file, chunk by chunk
+ * in time order, after writing moov in front of it.
+ *
+ * copyNextChunk() goes through the chunks one at a time on the calling
+ * thread. Alternatively, startParallel() lays out every chunk in advance,
+ * assigns the final stco/co64 values, splits mdat into contiguous byte
+ * ranges and copies them on separate threads, each with its own handles
+ * on the input and output files. Chunks are moved in batches, with one
+ * read per run of chunks adjacent in the input and one write per batch.
+ * This needs both ends to be regular files (not callbacks).
+ *
+ * With a journal (setJournal()), the planned copy periodically syncs the
+ * output and records how far each thread got; started with resume set,
+ * it reopens the output in place and skips what the journal covers,
+ * provided the layout is the same.
+ */
 class MP4FileCopy {
+public:
+    struct PlannedChunk {
+        uint64_t srcOffset;
+        uint64_t dstOffset;
+        uint32_t size;
+        bool done;
+    };
+private:
     struct ChunkInfo {
         mp4v2::impl::MP4ChunkId current, final;
         MP4Timestamp time;
     };
+    enum {
+        BATCH_SIZE = 4 * 1024 * 1024,
+        CHECKPOINT_SIZE = 64 * 1024 * 1024
+    };
     MP4FileX *m_mp4file;
     uint64_t m_nchunks;
+    uint64_t m_totalBytes;
+    std::atomic<uint64_t> m_copiedBytes;
+    std::atomic<uint64_t> m_copiedChunks;
     std::vector<ChunkInfo> m_state;
+    std::vector<PlannedChunk> m_plan;
+    uint64_t m_layout;
+    uint64_t m_dataEnd;
+    CopyJournal *m_journal;
+    bool m_resume;
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_done;
+    unsigned m_running;
+    std::atomic<bool> m_abort;
+    std::exception_ptr m_error;
     mp4v2::platform::io::File *m_src;
     mp4v2::platform::io::File *m_dst;
+    void beginWrite();
+    int nextTrack();
+    void plan();
+    void copyRange(size_t begin, size_t end);
+    void checkpoint(mp4v2::platform::io::File &dst, uint64_t start);
+    void joinWorkers();
 public:
     MP4FileCopy(mp4v2::impl::MP4File *file);
-    ~MP4FileCopy() { if (m_dst) finish(); }
-    void start(const char *path);
+    ~MP4FileCopy();
+    /* resume: reopen an existing output in place instead of creating it */
+    void start(const char *path, bool resume = false);
+    void start(const MP4IOCallbacks *callbacks, void *handle);
+    /* writes moov and closes the output; without it the output is dropped */
     void finish();
     bool copyNextChunk();
+    void setJournal(CopyJournal *journal) { m_journal = journal; }
+    /* copies mdat on n threads; follow with waitParallel() */
+    void startParallel(unsigned threads);
+    /*
+     * Waits up to the given time; returns true while copying goes on.
+     * Throws the first error of a worker once all of them are done.
+     */
+    bool waitParallel(unsigned milliseconds);
+    /*
+     * Lays out the chunks and completes the output but for the payload of
+     * mdat, which is left for the caller to write; returns where each
+     * chunk goes, in output order. The chunk offsets of the file are left
+     * pointing into the output.
+     */
+    const std::vector<PlannedChunk> &layOut();
     uint64_t getTotalChunks() { return m_nchunks; }
+    uint64_t getTotalBytes() { return m_totalBytes; }
+    uint64_t getCopiedBytes() { return m_copiedBytes; }
+    uint64_t getCopiedChunks() { return m_copiedChunks; }
+};
+
+/*
+ * Writes several edits of one parsed file, reading its media data once.
+ *
+ * After each edit, addOutput() writes the file as it is then to a new
+ * output with MP4FileCopy::layOut(), and puts the chunk offsets back.
+ * copyNextBatch() then reads the chunks in input order, a batch at a
+ * time, and hands each of them to every output. As an edit changes how
+ * the tracks interleave, the chunks of a batch land all over an output:
+ * a few staging windows per output gather them, and each window goes out
+ * in one write once full, or when the least recently used has to make
+ * room.
+ */
+class MP4FanOutCopy {
+    enum {
+        BATCH_SIZE = 4 * 1024 * 1024,
+        WINDOW_SIZE = 4 * 1024 * 1024,
+        WINDOWS = 4
+    };
+    typedef MP4FileCopy::PlannedChunk PlannedChunk;
+    struct Window {
+        uint64_t base;      // output offset, a multiple of WINDOW_SIZE
+        uint64_t filled;
+        uint64_t lastUse;
+        std::vector<uint8_t> data;
+        std::vector<std::pair<uint32_t, uint32_t> > runs;  // staged, sorted
+    };
+    struct Output {
+        std::string path;
+        std::vector<PlannedChunk> plan;     // in input order
+        mp4v2::platform::io::File *file;
+        std::vector<Window> windows;
+    };
+    MP4FileX *m_mp4file;
+    std::vector<std::vector<uint64_t> > m_offsets;  // of each track's chunks
+    std::vector<Output> m_outputs;
+    std::vector<uint8_t> m_buffer;
+    size_t m_next;
+    uint64_t m_clock;
+    uint64_t m_totalChunks;
+    uint64_t m_totalBytes;
+    uint64_t m_copiedBytes;
+    uint64_t m_copiedChunks;
+public:
+    MP4FanOutCopy(mp4v2::impl::MP4File *file);
+    ~MP4FanOutCopy();
+    void addOutput(const char *path);
+    /* returns false once every chunk is in every output */
+    bool copyNextBatch();
+    void finish();
+    uint64_t getTotalChunks() { return m_totalChunks; }
+    uint64_t getTotalBytes() { return m_totalBytes; }
+    uint64_t getCopiedBytes() { return m_copiedBytes; }
+    uint64_t getCopiedChunks() { return m_copiedChunks; }
+private:
+    void stage(Output &output, uint64_t offset, const uint8_t *data,
+               uint64_t size);
+    void flush(Output &output, Window &window);
+
+    MP4FanOutCopy(const MP4FanOutCopy &);
+    MP4FanOutCopy &operator=(const MP4FanOutCopy &);
 };
 
 #endif
@@ -0,0 +1,115 @@
+#ifndef MP4FPSMOD_H
+#define MP4FPSMOD_H
+
+/*
+ * C API of libmp4fpsmod: the timecode editing of mp4fpsmod, in process.
+ *
+ *   mp4fpsmod *h = mp4fpsmod_create();
+ *   mp4fpsmod_open(h, "in.mp4", NULL, NULL, MP4FPSMOD_READ);
+ *   mp4fpsmod_get_timecodes(h, ...);       what -p prints
+ *   mp4fpsmod_set_fps(h, ...);             -r, or
+ *   mp4fpsmod_set_timecodes(h, ...);       -t
+ *   mp4fpsmod_set_compress_dts(h, 1);      -c, and so on
+ *   mp4fpsmod_write(h, "out.mp4", NULL, NULL, NULL, NULL);   -o, or
+ *   mp4fpsmod_save(h);                     -i, after MP4FPSMOD_MODIFY
+ *   mp4fpsmod_destroy(h);
+ *
+ * The settings are applied by mp4fpsmod_write() or mp4fpsmod_save(),
+ * once per opened file, the way the command line applies its options.
+ *
+ * Functions returning int return 0 on success, and -1 on failure, with
+ * mp4fpsmod_error() telling why. A handle must not be used from two
+ * threads at a time; separate handles are independent.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mp4fpsmod mp4fpsmod;
+
+/*
+ * Caller provided I/O, with the semantics of MP4IOCallbacks of libmp4v2:
+ * the calls return 0 on success; size returns -1 on failure.
+ * write and truncate may be NULL for an input opened with MP4FPSMOD_READ.
+ */
+typedef struct mp4fpsmod_io {
+    int64_t (*size)(void *handle);
+    int (*seek)(void *handle, int64_t pos);
+    int (*read)(void *handle, void *buffer, int64_t size, int64_t *nin);
+    int (*write)(void *handle, const void *buffer, int64_t size,
+                 int64_t *nout);
+    int (*truncate)(void *handle, int64_t size);
+} mp4fpsmod_io;
+
+/* a run of frames at a constant rate; 0 frames means the rest */
+typedef struct mp4fpsmod_range {
+    uint32_t frames;
+    int fps_num;
+    int fps_denom;
+} mp4fpsmod_range;
+
+enum {
+    MP4FPSMOD_READ,     /* to be written out with mp4fpsmod_write() */
+    MP4FPSMOD_MODIFY    /* to be patched in place with mp4fpsmod_save() */
+};
+
+/* called while mdat is copied */
+typedef void (*mp4fpsmod_progress)(void *arg, uint64_t bytes,
+                                   uint64_t total);
+
+const char *mp4fpsmod_version(void);
+
+mp4fpsmod *mp4fpsmod_create(void);
+void mp4fpsmod_destroy(mp4fpsmod *h);
+/* the reason of the last failure */
+const char *mp4fpsmod_error(const mp4fpsmod *h);
+
+/* reads path, or when io is not NULL, the file behind io and handle */
+int mp4fpsmod_open(mp4fpsmod *h, const char *path, const mp4fpsmod_io *io,
+                   void *handle, int mode);
+
+/* of the video track */
+size_t mp4fpsmod_frame_count(const mp4fpsmod *h);
+uint32_t mp4fpsmod_timescale(const mp4fpsmod *h);
+/*
+ * Stores the presentation time of the frames, in milliseconds from the
+ * first one, into ms, which holds count >= mp4fpsmod_frame_count() entries.
+ */
+int mp4fpsmod_get_timecodes(mp4fpsmod *h, double *ms, size_t count);
+
+int mp4fpsmod_set_fps(mp4fpsmod *h, const mp4fpsmod_range *ranges,
+                      size_t count);
+/*
+ * Timecodes in milliseconds, as in a timecode-v2 file: one per frame,
+ * optionally followed by the end of the last frame.
+ */
+int mp4fpsmod_set_timecodes(mp4fpsmod *h, const double *ms, size_t count);
+void mp4fpsmod_set_optimize(mp4fpsmod *h, int enable);
+void mp4fpsmod_set_compress_dts(mp4fpsmod *h, int enable);
+/* audio delay in milliseconds */
+void mp4fpsmod_set_delay(mp4fpsmod *h, int ms);
+/* 0: chosen from the rates, -1: kept, otherwise the time scale to use */
+void mp4fpsmod_set_timescale(mp4fpsmod *h, int timescale);
+void mp4fpsmod_set_audio_timedelta(mp4fpsmod *h, int delta);
+/*
+ * Rewrites the timecodes into runs of a constant delta, each as long as
+ * moving no frame by more than ms milliseconds allows; 0 turns it off.
+ * Writing fails if two frames are too close for that at the time scale.
+ */
+void mp4fpsmod_set_max_deviation(mp4fpsmod *h, double ms);
+
+/* writes the result to path, or when io is not NULL, to io and handle */
+int mp4fpsmod_write(mp4fpsmod *h, const char *path, const mp4fpsmod_io *io,
+                    void *handle, mp4fpsmod_progress progress, void *arg);
+/* rewrites the file opened with MP4FPSMOD_MODIFY in place */
+int mp4fpsmod_save(mp4fpsmod *h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
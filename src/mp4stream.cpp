@@ -0,0 +1,290 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <sstream>
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif
+#include "mp4stream.h"
+#include "mp4trackx.h"
+
+using mp4v2::impl::MP4File;
+using mp4v2::impl::MP4Atom;
+using mp4v2::impl::MP4Track;
+using mp4v2::impl::MP4IntegerProperty;
+using mp4v2::platform::io::File;
+
+namespace {
+
+size_t readFd(int fd, void *buffer, size_t size)
+{
+    char *p = static_cast<char*>(buffer);
+    size_t done = 0;
+    while (done < size) {
+#if defined(_WIN32)
+        int n = _read(fd, p + done, static_cast<unsigned>(
+                    std::min<size_t>(size - done, 0x40000000)));
+#else
+        ssize_t n = ::read(fd, p + done, size - done);
+#endif
+        if (n == 0)
+            break;
+        if (n < 0)
+            throw std::runtime_error("read error on standard input");
+        done += n;
+    }
+    return done;
+}
+
+void writeFd(int fd, const void *buffer, size_t size)
+{
+    const char *p = static_cast<const char*>(buffer);
+    while (size > 0) {
+#if defined(_WIN32)
+        int n = _write(fd, p, static_cast<unsigned>(
+                    std::min<size_t>(size, 0x40000000)));
+#else
+        ssize_t n = ::write(fd, p, size);
+#endif
+        if (n <= 0)
+            throw std::runtime_error("write error on standard output");
+        p += n;
+        size -= n;
+    }
+}
+
+uint32_t getBE32(const uint8_t *p)
+{
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+uint64_t getBE64(const uint8_t *p)
+{
+    return (static_cast<uint64_t>(getBE32(p)) << 32) | getBE32(p + 4);
+}
+
+}
+
+StreamReader::StreamReader(const char *path)
+    : m_file(0)
+{
+    if (isStdio(path)) {
+#if defined(_WIN32)
+        _setmode(0, _O_BINARY);
+#endif
+        return;
+    }
+    m_file = new File(path, File::MODE_READ);
+    if (m_file->open()) {
+        delete m_file;
+        throw std::runtime_error(std::string("cannot open ") + path);
+    }
+    m_file->setStreaming(true);
+}
+
+StreamReader::~StreamReader()
+{
+    delete m_file;
+}
+
+size_t StreamReader::read(void *buffer, size_t size)
+{
+    if (!m_file)
+        return readFd(0, buffer, size);
+    /* File::read() fails on a short read, unlike read(2) */
+    if (m_file->position >= m_file->size)
+        return 0;
+    size = static_cast<size_t>(
+        std::min<File::Size>(size, m_file->size - m_file->position));
+    File::Size nin = 0;
+    if (m_file->read(buffer, size, nin))
+        throw std::runtime_error("read error on " + m_file->name);
+    return nin;
+}
+
+StreamWriter::StreamWriter(const char *path)
+    : m_file(0)
+{
+    if (StreamReader::isStdio(path)) {
+#if defined(_WIN32)
+        _setmode(1, _O_BINARY);
+#endif
+        return;
+    }
+    m_file = new File(path, File::MODE_CREATE);
+    if (m_file->open()) {
+        delete m_file;
+        throw std::runtime_error(std::string("cannot create ") + path);
+    }
+    m_file->setStreaming(true);
+}
+
+StreamWriter::~StreamWriter()
+{
+    delete m_file;
+}
+
+void StreamWriter::write(const void *buffer, size_t size)
+{
+    if (!m_file)
+        return writeFd(1, buffer, size);
+    File::Size nout = 0;
+    if (m_file->write(buffer, size, nout) || nout != File::Size(size))
+        throw std::runtime_error("write error on " + m_file->name);
+}
+
+void StreamWriter::close()
+{
+    if (m_file && m_file->close())
+        throw std::runtime_error("write error on " + m_file->name);
+}
+
+MP4StreamCopy::MP4StreamCopy(StreamReader &in)
+    : m_in(in), m_out(0), m_buffer(1 << 20),
+      m_moovStart(0), m_moovEnd(0), m_dataEnd(0), m_copiedBytes(0),
+      m_copiedChunks(0)
+{
+}
+
+bool MP4StreamCopy::readFully(void *buffer, size_t size)
+{
+    return m_in.read(buffer, size) == size;
+}
+
+void MP4StreamCopy::readHead()
+{
+    for (;;) {
+        uint8_t header[16];
+        size_t start = m_head.size();
+        if (!readFully(header, 8))
+            throw std::runtime_error("moov atom not found in the input");
+        uint64_t size = getBE32(header);
+        size_t hsize = 8;
+        if (size == 1) {
+            if (!readFully(header + 8, 8))
+                throw std::runtime_error("truncated atom header");
+            size = getBE64(header + 8);
+            hsize = 16;
+        }
+        bool isMoov = !std::memcmp(header + 4, "moov", 4);
+        if (!std::memcmp(header + 4, "mdat", 4))
+            throw std::runtime_error("mdat precedes moov; "
+                                     "only fast-start input can be streamed");
+        m_head.insert(m_head.end(), header, header + hsize);
+        if (size == 0) {
+            if (!isMoov)
+                throw std::runtime_error("moov atom not found in the input");
+            for (size_t n; (n = m_in.read(&m_buffer[0], m_buffer.size())); )
+                m_head.insert(m_head.end(), &m_buffer[0], &m_buffer[0] + n);
+        } else {
+            if (size < hsize)
+                throw std::runtime_error("invalid atom size in the input");
+            m_head.resize(start + size);
+            if (!readFully(&m_head[start + hsize], size - hsize))
+                throw std::runtime_error("unexpected end of input");
+        }
+        if (isMoov) {
+            m_moovStart = start;
+            m_moovEnd = m_head.size();
+            return;
+        }
+    }
+}
+
+void MP4StreamCopy::serializeMoov(MP4File *file, std::vector<uint8_t> *v)
+{
+    MP4Atom *moov = file->FindAtom("moov");
+    uint8_t *bytes;
+    uint64_t size;
+    file->EnableMemoryBuffer(0, m_moovEnd - m_moovStart + 4096);
+    try {
+        moov->Write();
+    } catch (...) {
+        file->DisableMemoryBuffer(&bytes, &size);
+        MP4Free(bytes);
+        throw;
+    }
+    file->DisableMemoryBuffer(&bytes, &size);
+    v->assign(bytes, bytes + size);
+    MP4Free(bytes);
+}
+
+void MP4StreamCopy::start(MP4File *file, StreamWriter *out)
+{
+    m_out = out;
+    /* the file is open read-only, so go through the atom directly */
+    mp4v2::impl::MP4Property *mtime;
+    if (file->FindAtom("moov.mvhd")->FindProperty("mvhd.modificationTime",
+                                                   &mtime))
+        static_cast<MP4IntegerProperty*>(mtime)->SetValue(
+                mp4v2::impl::MP4GetAbsTimestamp());
+
+    std::vector<uint8_t> moov;
+    serializeMoov(file, &moov);
+    int64_t delta = static_cast<int64_t>(moov.size())
+                  - static_cast<int64_t>(m_moovEnd - m_moovStart);
+
+    /*
+     * Chunk offsets are fixed width, so shifting them does not change
+     * the moov size and one more serialization gives the final moov.
+     */
+    uint32_t numTracks = file->GetNumberOfTracks();
+    for (uint32_t i = 0; i < numTracks; ++i) {
+        MP4TrackX *track = reinterpret_cast<MP4TrackX*>(
+                file->GetTrack(file->FindTrackId(i)));
+        MP4IntegerProperty *offsets = track->ChunkOffsetProperty();
+        bool is32 = offsets->GetType() == mp4v2::impl::Integer32Property;
+        uint32_t numChunks = track->GetNumberOfChunks();
+        for (uint32_t j = 0; j < numChunks; ++j) {
+            uint64_t offset = offsets->GetValue(j);
+            if (offset < m_moovEnd)
+                throw std::runtime_error("media data precedes moov; "
+                                         "only fast-start input can be streamed");
+            uint64_t end = offset + track->GetChunkSizeX(j + 1);
+            m_dataEnd = std::max(m_dataEnd, end);
+            m_chunkOffsets.push_back(offset);
+            uint64_t shifted = offset + delta;
+            if (is32 && shifted > 0xffffffff)
+                throw std::runtime_error("chunk offset overflows stco; "
+                                         "cannot stream this input");
+            offsets->SetValue(shifted, j);
+        }
+    }
+    std::sort(m_chunkOffsets.begin(), m_chunkOffsets.end());
+    m_dataEnd = std::max(m_dataEnd, m_moovEnd);
+
+    size_t moovSize = moov.size();
+    serializeMoov(file, &moov);
+    if (moov.size() != moovSize)
+        throw std::runtime_error("moov size changed while shifting offsets");
+
+    m_out->write(&m_head[0], m_moovStart);
+    m_out->write(&moov[0], moov.size());
+    std::vector<uint8_t>().swap(m_head);
+}
+
+bool MP4StreamCopy::copyNextBlock()
+{
+    size_t n = m_in.read(&m_buffer[0], m_buffer.size());
+    if (n == 0) {
+        if (m_moovEnd + m_copiedBytes < m_dataEnd)
+            throw std::runtime_error("unexpected end of input");
+        return false;
+    }
+    m_out->write(&m_buffer[0], n);
+    m_copiedBytes += n;
+    uint64_t pos = m_moovEnd + m_copiedBytes;
+    while (m_copiedChunks < m_chunkOffsets.size()
+           && m_chunkOffsets[m_copiedChunks] < pos)
+        ++m_copiedChunks;
+    return true;
+}
+
+void MP4StreamCopy::finish()
+{
+    m_out->close();
+}
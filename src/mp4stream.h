@@ -0,0 +1,65 @@
+#ifndef _MP4STREAM
+#define _MP4STREAM
+
+#include <cstring>
+#include <vector>
+#include "mp4v2wrapper.h"
+
+/*
+ * Forward-only byte streams for pipe mode: "-" means stdin/stdout,
+ * anything else is a regular file accessed strictly sequentially.
+ */
+class StreamReader {
+    mp4v2::platform::io::File *m_file;
+public:
+    StreamReader(const char *path);
+    ~StreamReader();
+    /* short count only at end of input */
+    size_t read(void *buffer, size_t size);
+    static bool isStdio(const char *path) { return !std::strcmp(path, "-"); }
+};
+
+class StreamWriter {
+    mp4v2::platform::io::File *m_file;
+public:
+    StreamWriter(const char *path);
+    ~StreamWriter();
+    void write(const void *buffer, size_t size);
+    void close();
+};
+
+/*
+ * Single forward pass over a fast-start (moov before mdat) input:
+ * everything up to the end of moov is buffered and parsed from memory,
+ * then the edited moov is emitted and the rest of the input is streamed
+ * through verbatim, with chunk offsets shifted by the moov size change.
+ */
+class MP4StreamCopy {
+    StreamReader &m_in;
+    StreamWriter *m_out;
+    std::vector<uint8_t> m_head;
+    std::vector<uint8_t> m_buffer;
+    uint64_t m_moovStart;
+    uint64_t m_moovEnd;
+    uint64_t m_dataEnd;
+    uint64_t m_copiedBytes;
+    std::vector<uint64_t> m_chunkOffsets;
+    size_t m_copiedChunks;
+
+    bool readFully(void *buffer, size_t size);
+    void serializeMoov(mp4v2::impl::MP4File *file, std::vector<uint8_t> *v);
+public:
+    MP4StreamCopy(StreamReader &in);
+    void readHead();
+    const uint8_t *getHead() { return &m_head[0]; }
+    uint64_t getHeadSize() { return m_head.size(); }
+    void start(mp4v2::impl::MP4File *file, StreamWriter *out);
+    bool copyNextBlock();
+    void finish();
+    uint64_t getTotalChunks() { return m_chunkOffsets.size(); }
+    uint64_t getCopiedChunks() { return m_copiedChunks; }
+    uint64_t getTotalBytes() { return m_dataEnd - m_moovEnd; }
+    uint64_t getCopiedBytes() { return m_copiedBytes; }
+};
+
+#endif
@@ -66,6 +66,21 @@ TrackEditor::TrackEditor(MP4TrackX *track)
     std::sort(m_ctsIndex.begin(), m_ctsIndex.end(), CTSComparator(this));
 }
 
+TrackEditor::TrackEditor(MP4TrackX *track, SampleTable *table)
+    : m_track(track), m_compressDTS(false), m_audioDelay(0)
+{
+    m_timeScale = table->timeScale;
+    m_sampleTimes.swap(table->times);
+    m_ctsIndex.swap(table->ctsIndex);
+}
+
+void TrackEditor::SaveTable(SampleTable *table) const
+{
+    table->timeScale = m_timeScale;
+    table->times = m_sampleTimes;
+    table->ctsIndex = m_ctsIndex;
+}
+
 void TrackEditor::SetFPS(FPSRange *fpsRanges, size_t numRanges, int timeScale)
 {
     uint32_t scale = m_timeScale;
@@ -199,6 +214,215 @@ uint64_t TrackEditor::CalcSampleTimes(
     return DTS(frame);
 }
 
+bool TrackEditor::SetFPSFromRuns(const FPSRange *fpsRanges,
+                                 size_t numRanges, int timeScale)
+{
+    std::vector<CttsRun> cttsRuns;
+    if (m_compressDTS || !numRanges || !GetFrameCount()
+        || !LoadCttsRuns(&cttsRuns))
+        return false;
+
+    // normalized on a copy, so that falling back finds them as given
+    std::vector<FPSRange> ranges(fpsRanges, fpsRanges + numRanges);
+    FPSRange *begin = &ranges[0], *end = begin + numRanges;
+    uint32_t scale = m_timeScale;
+    NormalizeFPSRange(begin, end);
+    if (timeScale == 0)
+        scale = CalcTimeScale(begin, end);
+    else if (timeScale > 0)
+        scale = timeScale;
+    std::vector<Span> spans;
+    uint64_t duration;
+    if (!CalcSpans(begin, end, scale, &spans, &duration))
+        return false;
+    if (duration > 0x7fffffff && timeScale == 0) {
+        double t = static_cast<double>(scale) * 0x7fffffff / duration;
+        for (scale = 100; scale < t; scale *= 10)
+            ;
+        scale /= 10;
+        if (!CalcSpans(begin, end, scale, &spans, &duration))
+            return false;
+    }
+
+    Runs stts;
+    for (size_t i = 0; i < spans.size(); ++i) {
+        uint32_t end = i + 1 < spans.size() ? spans[i + 1].first
+                                            : GetFrameCount();
+        if (stts.size() && stts.back().second == spans[i].delta)
+            stts.back().first += end - spans[i].first;
+        else
+            stts.push_back(std::make_pair(end - spans[i].first,
+                                          spans[i].delta));
+    }
+    /*
+     * A frame of a run shown shift frames later than it's decoded gets
+     * T(k + shift) - T(k), which stays the same while k and k + shift are
+     * in spans of the same delta: only frames whose shift reaches over a
+     * change of rate get an offset of their own.
+     */
+    Runs ctts;
+    int64_t initialDelay = 0;
+    for (size_t i = 0; i < cttsRuns.size(); ++i) {
+        int64_t shift = cttsRuns[i].slot - cttsRuns[i].first;
+        uint32_t end = cttsRuns[i].first + cttsRuns[i].count;
+        for (uint32_t k = cttsRuns[i].first; k < end; ) {
+            size_t a, b;
+            int64_t offset = SpanTime(spans, k + shift, &b)
+                           - SpanTime(spans, k, &a);
+            uint32_t n = 1;
+            if (spans[a].delta == spans[b].delta) {
+                int64_t limit = end;
+                if (a + 1 < spans.size())
+                    limit = std::min<int64_t>(limit, spans[a + 1].first);
+                if (b + 1 < spans.size())
+                    limit = std::min(limit, spans[b + 1].first - shift);
+                n = limit - k;
+            }
+            if (ctts.size() && ctts.back().second == offset)
+                ctts.back().first += n;
+            else
+                ctts.push_back(std::make_pair(n, offset));
+            initialDelay = std::max(initialDelay, -offset);
+            k += n;
+        }
+    }
+    for (size_t i = 0; i < ctts.size(); ++i) {
+        ctts[i].second += initialDelay;
+        if (ctts[i].second > INT32_MAX)
+            return false;
+    }
+
+    m_timeScale = scale;
+    m_initialDelay = initialDelay;
+    UpdateMdhd(duration);
+    ReplaceRuns(m_track->SttsCountProperty(),
+                m_track->SttsSampleCountProperty(),
+                m_track->SttsSampleDeltaProperty(), stts);
+    if (m_track->CttsCountProperty())
+        ReplaceRuns(m_track->CttsCountProperty(),
+                    m_track->CttsSampleCountProperty(),
+                    m_track->CttsSampleOffsetProperty(), ctts);
+    m_track->InvalidateSampleTimesX();
+    int64_t delay = m_initialDelay;
+    if (m_audioDelay > 0)
+        delay += GetAudioDelayInTimeScale();
+    UpdateEditLists(m_track, delay, m_audioDelay);
+    return true;
+}
+
+/*
+ * The frame times CalcSampleTimes() would give, as spans of a constant
+ * delta; false unless every delta is a whole number of ticks.
+ */
+bool TrackEditor::CalcSpans(const FPSRange *begin, const FPSRange *end,
+                            uint32_t timeScale, std::vector<Span> *spans,
+                            uint64_t *duration)
+{
+    uint32_t frame = 0;
+    uint64_t time = 0;
+    spans->clear();
+    for (const FPSRange *fp = begin; fp != end; ++fp) {
+        if (!fp->numFrames)
+            continue;
+        double delta = fps2tsdelta(fp->fps_num, fp->fps_denom, timeScale);
+        if (delta < 1.0 || delta > INT32_MAX
+            || delta != static_cast<uint32_t>(delta))
+            return false;
+        Span span = { frame, time, static_cast<uint32_t>(delta) };
+        spans->push_back(span);
+        frame += fp->numFrames;
+        time += static_cast<uint64_t>(fp->numFrames) * span.delta;
+    }
+    *duration = time;
+    return true;
+}
+
+uint64_t TrackEditor::SpanTime(const std::vector<Span> &spans,
+                               uint32_t frame, size_t *index)
+{
+    size_t lo = 0, hi = spans.size();
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (spans[mid].first <= frame)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    *index = lo;
+    return spans[lo].base
+        + static_cast<uint64_t>(frame - spans[lo].first) * spans[lo].delta;
+}
+
+/*
+ * Where each ctts run goes in presentation order. With the DTS evenly
+ * spaced (the delta of the last frame aside), a run at offset o is shown
+ * o / delta frames later than another at 0; the runs have to cover each
+ * position exactly once. Without ctts, frames are shown as decoded.
+ */
+bool TrackEditor::LoadCttsRuns(std::vector<CttsRun> *runs)
+{
+    uint32_t numFrames = GetFrameCount();
+    uint32_t numStts = m_track->SttsCountProperty()->GetValue();
+    uint32_t frame = 0, delta = 0;
+    bool even = true;
+    for (uint32_t i = 0; i < numStts; ++i) {
+        uint32_t count = m_track->SttsSampleCountProperty()->GetValue(i);
+        uint32_t sampleDelta = m_track->SttsSampleDeltaProperty()->GetValue(i);
+        if (!count)
+            continue;
+        if (!sampleDelta || count > numFrames - frame)
+            return false;
+        if (!delta)
+            delta = sampleDelta;
+        else if (sampleDelta != delta && frame != numFrames - 1)
+            even = false;
+        frame += count;
+    }
+    if (frame != numFrames)
+        return false;
+    if (!m_track->CttsCountProperty())
+        return true;
+    if (!even)
+        return false;
+
+    uint32_t numCtts = m_track->CttsCountProperty()->GetValue();
+    int64_t first = 0, minSlot = 0;
+    frame = 0;
+    for (uint32_t i = 0; i < numCtts; ++i) {
+        uint32_t count = m_track->CttsSampleCountProperty()->GetValue(i);
+        int32_t offset = m_track->CttsSampleOffsetProperty()->GetValue(i);
+        if (!count)
+            continue;
+        if (count > numFrames - frame
+            || static_cast<int64_t>(frame) * delta + offset < 0)
+            return false;
+        if (runs->empty())
+            first = offset;
+        if ((offset - first) % delta)
+            return false;
+        CttsRun run = { frame, count, frame + (offset - first) / delta };
+        runs->push_back(run);
+        minSlot = std::min(minSlot, run.slot);
+        frame += count;
+    }
+    if (frame != numFrames)
+        return false;
+
+    std::vector<std::pair<int64_t, uint32_t> > order;
+    for (size_t i = 0; i < runs->size(); ++i) {
+        (*runs)[i].slot -= minSlot;
+        order.push_back(std::make_pair((*runs)[i].slot, (*runs)[i].count));
+    }
+    std::sort(order.begin(), order.end());
+    int64_t next = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (order[i].first != next)
+            return false;
+        next += order[i].second;
+    }
+    return true;
+}
+
 int64_t TrackEditor::CalcInitialDelay()
 {
     int64_t maxdiff = 0;
@@ -292,17 +516,30 @@ void TrackEditor::AdjustTimeCodes()
 }
 
 void TrackEditor::DoEditTimeCodes()
+{
+    UpdateMdhd(GetMediaDuration());
+    UpdateStts();
+    if (m_track->CttsCountProperty()) {
+        UpdateCtts();
+    }
+    int64_t delay = m_initialDelay;
+    if (!m_compressDTS && m_audioDelay > 0)
+        delay += GetAudioDelayInTimeScale();
+    UpdateEditLists(m_track, delay, m_compressDTS ? 0 : m_audioDelay);
+}
+
+void TrackEditor::UpdateMdhd(uint64_t duration)
 {
     MP4File &file = m_track->GetFile();
     uint32_t ntracks = file.GetNumberOfTracks();
 
     if (m_timeScale != m_track->GetTimeScale() ||
-        GetMediaDuration() != m_track->MediaDurationProperty()->GetValue())
+        duration != m_track->MediaDurationProperty()->GetValue())
     {
         m_track->RebuildMdhd();
         m_track->TimeScaleProperty()->SetValue(m_timeScale);
         m_track->MediaDurationProperty()->SetValue(0);
-        m_track->UpdateDurationsX(GetMediaDuration());
+        m_track->UpdateDurationsX(duration);
 
         int64_t max_duration = 0;
         for (uint32_t i = 0; i < ntracks; ++i) {
@@ -317,29 +554,76 @@ void TrackEditor::DoEditTimeCodes()
         }
         file.SetDuration(max_duration);
     }
-    
-    UpdateStts();
-    if (m_track->CttsCountProperty()) {
-        UpdateCtts();
-    }
-    int64_t delay = m_initialDelay;
-    if (!m_compressDTS && m_audioDelay > 0)
-        delay += GetAudioDelayInTimeScale();
-    UpdateElst(m_track, delay);
-    m_track->UpdateModificationTimesX();
+}
+
+void TrackEditor::DelayByEditLists(MP4TrackX *track, int audioDelay)
+{
+    int64_t delay = FirstCTS(track);
+    if (audioDelay > 0)
+        delay += static_cast<int64_t>(audioDelay / 1000.0
+                                      * track->GetTimeScale());
+    UpdateEditLists(track, delay, audioDelay);
+}
+
+/*
+ * Sets the edit list of the video track to start at mediaTime, and those
+ * of the audio tracks to start late by -audioDelay ms when it's negative.
+ */
+void TrackEditor::UpdateEditLists(MP4TrackX *track, int64_t mediaTime,
+                                  int audioDelay)
+{
+    MP4File &file = track->GetFile();
+    uint32_t ntracks = file.GetNumberOfTracks();
+    UpdateElst(track, mediaTime);
+    track->UpdateModificationTimesX();
     for (uint32_t i = 0; i < ntracks; ++i) {
-        MP4TrackX *track = reinterpret_cast<MP4TrackX*>(
+        MP4TrackX *audio = reinterpret_cast<MP4TrackX*>(
             file.GetTrack(file.FindTrackId(i)));
-        if (std::strcmp(track->GetType(), "soun"))
+        if (std::strcmp(audio->GetType(), "soun"))
             continue;
-        delay = (!m_compressDTS && m_audioDelay < 0)
-            ? -1 * m_audioDelay / 1000.0 * track->GetTimeScale()
+        int64_t delay = audioDelay < 0
+            ? -1 * audioDelay / 1000.0 * audio->GetTimeScale()
             : 0;
-        UpdateElst(track, delay);
-        track->UpdateModificationTimesX();
+        UpdateElst(audio, delay);
+        audio->UpdateModificationTimesX();
     }
 }
 
+/*
+ * Earliest presentation time, going through the stts and ctts runs side
+ * by side: within a piece where both stay the same, it's at the start.
+ */
+int64_t TrackEditor::FirstCTS(MP4TrackX *track)
+{
+    if (!track->CttsCountProperty())
+        return 0;
+    uint32_t numStts = track->SttsCountProperty()->GetValue();
+    uint32_t numCtts = track->CttsCountProperty()->GetValue();
+    int64_t first = INT64_MAX;
+    uint64_t dts = 0;
+    uint32_t sttsLeft = 0, cttsLeft = 0;
+    for (uint32_t si = 0, ci = 0; ; ) {
+        if (!sttsLeft) {
+            if (si == numStts) break;
+            sttsLeft = track->SttsSampleCountProperty()->GetValue(si++);
+            continue;
+        }
+        if (!cttsLeft) {
+            if (ci == numCtts) break;
+            cttsLeft = track->CttsSampleCountProperty()->GetValue(ci++);
+            continue;
+        }
+        int32_t offset = track->CttsSampleOffsetProperty()->GetValue(ci - 1);
+        uint32_t delta = track->SttsSampleDeltaProperty()->GetValue(si - 1);
+        uint32_t n = std::min(sttsLeft, cttsLeft);
+        first = std::min(first, static_cast<int64_t>(dts) + offset);
+        dts += static_cast<uint64_t>(n) * delta;
+        sttsLeft -= n;
+        cttsLeft -= n;
+    }
+    return first == INT64_MAX ? 0 : first;
+}
+
 void TrackEditor::UpdateStts()
 {
     int32_t count = static_cast<int32_t>(
@@ -364,6 +648,7 @@ void TrackEditor::UpdateStts()
         prev_delta = delta;
         m_track->SttsSampleCountProperty()->IncrementValue(1, sttsIndex);
     }
+    m_track->InvalidateSampleTimesX();
 }
 
 void TrackEditor::UpdateCtts()
@@ -387,6 +672,21 @@ void TrackEditor::UpdateCtts()
         }
         m_track->CttsSampleCountProperty()->IncrementValue(1, cttsIndex);
     }
+    m_track->InvalidateSampleTimesX();
+}
+
+void TrackEditor::ReplaceRuns(MP4Integer32Property *count,
+                              MP4Integer32Property *sampleCount,
+                              MP4Integer32Property *value, const Runs &runs)
+{
+    count->IncrementValue(-1 * static_cast<int32_t>(count->GetValue()));
+    sampleCount->SetCount(0);
+    value->SetCount(0);
+    for (size_t i = 0; i < runs.size(); ++i) {
+        count->IncrementValue();
+        sampleCount->AddValue(runs[i].first);
+        value->AddValue(static_cast<uint32_t>(runs[i].second));
+    }
 }
 
 void TrackEditor::UpdateElst(MP4TrackX *track, int64_t mediaTime)
@@ -7,11 +7,20 @@ struct SampleTime {
     uint64_t dts, cts;
 };
 
+/* decoded sample times of a track, see TrackEditor */
+struct SampleTable {
+    uint32_t timeScale;
+    std::vector<SampleTime> times;      // one extra entry after the last
+    std::vector<uint32_t> ctsIndex;     // indices into times, in CTS order
+};
+
 struct FPSRange {
     uint32_t numFrames;
     int fps_num, fps_denom;
 };
 
+int gcd(int a, int b);
+
 /*
  *  XXX:
  *  Ugly class only to reveal protected members of MP4Track
@@ -31,6 +40,11 @@ public:
     void UpdateModificationTimesX() {
         return UpdateModificationTimes();
     }
+    /* forget where the last sample time lookup was, after stts/ctts change */
+    void InvalidateSampleTimesX() {
+        m_cachedSttsSid = MP4_INVALID_SAMPLE_ID;
+        m_cachedCttsSid = MP4_INVALID_SAMPLE_ID;
+    }
 
     mp4v2::impl::MP4Integer32Property*& TimeScaleProperty() {
         return m_pTimeScaleProperty;
@@ -44,6 +58,9 @@ public:
     mp4v2::impl::MP4IntegerProperty*& MediaModificationProperty() {
         return m_pMediaModificationProperty;
     }
+    mp4v2::impl::MP4IntegerProperty* TrackModificationProperty() {
+        return m_pTrackModificationProperty;
+    }
     mp4v2::impl::MP4Integer32Property* SttsCountProperty() {
         return m_pSttsCountProperty;
     }
@@ -71,6 +88,15 @@ public:
     mp4v2::impl::MP4IntegerProperty* ElstDurationProperty() {
         return m_pElstDurationProperty;
     }
+    mp4v2::impl::MP4Integer16Property* ElstRateProperty() {
+        return m_pElstRateProperty;
+    }
+    mp4v2::impl::MP4IntegerProperty* ChunkOffsetProperty() {
+        return m_pChunkOffsetProperty;
+    }
+    uint32_t GetChunkSizeX(mp4v2::impl::MP4ChunkId chunkId) {
+        return GetChunkSize(chunkId);
+    }
 };
 
 class TrackEditor {
@@ -91,14 +117,42 @@ class TrackEditor {
     int m_audioDelay;
 public:
     TrackEditor(MP4TrackX *track);
+    /*
+     * Takes over a table saved by SaveTable() instead of decoding the
+     * track's. track may be 0 when the editor is only read from.
+     */
+    TrackEditor(MP4TrackX *track, SampleTable *table);
+    void SaveTable(SampleTable *table) const;
     void EnableDTSCompression(bool enable) { m_compressDTS = enable; }
     void SetAudioDelay(int delay) { m_audioDelay = delay; }
     void SetFPS(FPSRange *fpsRanges, size_t numRanges, int timeScale);
+    /*
+     * SetFPS(), AdjustTimeCodes() and DoEditTimeCodes() in one go, for an
+     * editor made with an empty table: the new stts and ctts come from
+     * the ranges and the present stts and ctts runs, without decoding the
+     * samples. Works when each range has a whole number of ticks per
+     * frame, and the frame order follows from the runs (the DTS are evenly
+     * spaced). Returns false otherwise, having changed neither the track
+     * nor fpsRanges.
+     */
+    bool SetFPSFromRuns(const FPSRange *fpsRanges, size_t numRanges,
+                        int timeScale);
     void SetTimeCodes(double *timeCodes, size_t count, uint32_t timeScale);
     void AdjustTimeCodes();
     void DoEditTimeCodes();
+    /*
+     * Delays audio by audioDelay milliseconds with edit lists alone, as
+     * DoEditTimeCodes() does without DTS compression, keeping the sample
+     * times as they are; track is the video track. Looks at the stts and
+     * ctts runs only, and does not decode the samples.
+     */
+    static void DelayByEditLists(MP4TrackX *track, int audioDelay);
     uint32_t GetTimeScale() const { return m_timeScale; }
-    size_t GetFrameCount() const { return m_track->GetNumberOfSamples(); }
+    size_t GetFrameCount() const
+    {
+        return m_track ? m_track->GetNumberOfSamples()
+                       : m_sampleTimes.size() - 1;
+    }
     uint64_t &DTS(size_t n) { return m_sampleTimes[n].dts; }
     uint64_t &CTS(size_t n) { return m_sampleTimes[m_ctsIndex[n]].cts; }
     uint64_t GetMediaDuration() { return CTS(GetFrameCount()) - CTS(0); }
@@ -114,6 +168,27 @@ private:
     uint32_t CalcTimeScale(FPSRange *begin, const FPSRange *end);
     uint64_t CalcSampleTimes(
             const FPSRange *begin, const FPSRange *end, uint32_t timeScale);
+    struct Span {
+        uint32_t first;     // frame
+        uint64_t base;      // its time
+        uint32_t delta;
+    };
+    struct CttsRun {
+        uint32_t first, count;
+        int64_t slot;       // presentation order of the first frame
+    };
+    typedef std::vector<std::pair<uint32_t, int64_t> > Runs;
+    static bool CalcSpans(const FPSRange *begin, const FPSRange *end,
+                          uint32_t timeScale, std::vector<Span> *spans,
+                          uint64_t *duration);
+    static uint64_t SpanTime(const std::vector<Span> &spans, uint32_t frame,
+                             size_t *index);
+    bool LoadCttsRuns(std::vector<CttsRun> *runs);
+    void UpdateMdhd(uint64_t duration);
+    static void ReplaceRuns(mp4v2::impl::MP4Integer32Property *count,
+                            mp4v2::impl::MP4Integer32Property *sampleCount,
+                            mp4v2::impl::MP4Integer32Property *value,
+                            const Runs &runs);
     template <typename TimeCode>
     void DelayTimeCodes(int64_t offset, TimeCode timeCode);
     template <typename TimeCode>
@@ -122,7 +197,10 @@ private:
     int64_t CalcInitialDelay();
     void UpdateStts();
     void UpdateCtts();
-    void UpdateElst(MP4TrackX *track, int64_t mediaTime);
+    static void UpdateElst(MP4TrackX *track, int64_t mediaTime);
+    static void UpdateEditLists(MP4TrackX *track, int64_t mediaTime,
+                                int audioDelay);
+    static int64_t FirstCTS(MP4TrackX *track);
     int64_t GetAudioDelayInTimeScale()
     {
         return m_audioDelay / 1000.0 * m_timeScale;
@@ -0,0 +1,138 @@
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include "progress.h"
+
+namespace {
+
+std::string json_escape(const char *s)
+{
+    std::string r;
+    for (; *s; ++s) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            r += '\\';
+            r += c;
+        } else if (c < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof buf, "\\u%04x", c);
+            r += buf;
+        } else
+            r += c;
+    }
+    return r;
+}
+
+}
+
+Progress::Progress(Format format, int fd)
+    : m_format(format), m_fd(fd),
+      m_interval(format == FORMAT_JSON ? 1.0 : 0.25), m_step(0.01),
+      m_totalBytes(0), m_totalChunks(0), m_bytes(0), m_chunks(0),
+      m_lastRatio(0.0)
+{
+    m_start = m_last = clock::now();
+}
+
+bool Progress::ParseFormat(const char *s, Format *format)
+{
+    if (!std::strcmp(s, "none"))
+        *format = FORMAT_NONE;
+    else if (!std::strcmp(s, "text"))
+        *format = FORMAT_TEXT;
+    else if (!std::strcmp(s, "json"))
+        *format = FORMAT_JSON;
+    else
+        return false;
+    return true;
+}
+
+void Progress::Begin(uint64_t totalBytes, uint64_t totalChunks)
+{
+    m_totalBytes = totalBytes;
+    m_totalChunks = totalChunks;
+    m_bytes = m_chunks = 0;
+    m_lastRatio = 0.0;
+    m_start = m_last = clock::now();
+    if (m_format == FORMAT_JSON)
+        Report("start", m_start);
+}
+
+void Progress::Finish()
+{
+    if (m_format != FORMAT_NONE)
+        Report("done");
+}
+
+void Progress::Message(const char *event, const char *text)
+{
+    if (m_format == FORMAT_JSON) {
+        std::string s = "{\"event\":\"";
+        s += json_escape(event);
+        s += "\",\"message\":\"";
+        s += json_escape(text);
+        s += "\"}\n";
+        Emit(s);
+    } else if (m_format == FORMAT_TEXT) {
+        Emit(std::string(text) + "\n");
+    }
+}
+
+void Progress::Report(const char *event, clock::time_point now)
+{
+    double ratio = GetRatio();
+    double elapsed = std::chrono::duration<double>(now - m_start).count();
+    double rate = elapsed > 0.0 ? m_bytes / elapsed : 0.0;
+    double eta = -1.0;
+    if (rate > 0.0 && m_totalBytes >= m_bytes)
+        eta = (m_totalBytes - m_bytes) / rate;
+    m_last = now;
+    m_lastRatio = ratio;
+
+    char buf[512];
+    if (m_format == FORMAT_JSON) {
+        char etabuf[32] = "null";
+        if (eta >= 0.0)
+            std::snprintf(etabuf, sizeof etabuf, "%.3f", eta);
+        std::snprintf(buf, sizeof buf,
+            "{\"event\":\"%s\",\"chunks\":%" PRIu64
+            ",\"total_chunks\":%" PRIu64 ",\"bytes\":%" PRIu64
+            ",\"total_bytes\":%" PRIu64 ",\"percent\":%.2f"
+            ",\"elapsed\":%.3f,\"bytes_per_sec\":%.0f,\"eta\":%s}\n",
+            event, m_chunks, m_totalChunks, m_bytes, m_totalBytes,
+            ratio * 100.0, elapsed, rate, etabuf);
+    } else {
+        char etabuf[32] = "--:--";
+        if (eta >= 0.0) {
+            unsigned sec = static_cast<unsigned>(eta + 0.5);
+            std::snprintf(etabuf, sizeof etabuf, "%u:%02u", sec / 60, sec % 60);
+        }
+        std::snprintf(buf, sizeof buf,
+            "\rWriting chunk %" PRIu64 "/%" PRIu64
+            " (%.0f%%, %.1f MB/s, ETA %s)...",
+            m_chunks, m_totalChunks, ratio * 100.0, rate / 1e6, etabuf);
+    }
+    Emit(buf);
+}
+
+void Progress::Emit(const std::string &s)
+{
+    const char *p = s.data();
+    size_t n = s.size();
+    while (n > 0) {
+#if defined(_WIN32)
+        int rc = _write(m_fd, p, static_cast<unsigned>(n));
+#else
+        ssize_t rc = write(m_fd, p, n);
+#endif
+        if (rc <= 0)
+            return;
+        p += rc;
+        n -= rc;
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdint.h>
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+/*
+ * Throttled progress reporter for the chunk copy loop.
+ *
+ * Update() is cheap enough to be called for every chunk; a report is
+ * actually emitted only when the configured time interval has elapsed,
+ * or when the completion ratio advanced by the configured step.
+ *
+ * FORMAT_TEXT writes a single "\r"-refreshed line (meant for a terminal),
+ * FORMAT_JSON writes one JSON object per line (meant for a pipe).
+ */
+class Progress {
+public:
+    enum Format { FORMAT_NONE, FORMAT_TEXT, FORMAT_JSON };
+private:
+    typedef std::chrono::steady_clock clock;
+
+    Format m_format;
+    int m_fd;
+    double m_interval;
+    double m_step;
+    uint64_t m_totalBytes;
+    uint64_t m_totalChunks;
+    uint64_t m_bytes;
+    uint64_t m_chunks;
+    double m_lastRatio;
+    clock::time_point m_start;
+    clock::time_point m_last;
+public:
+    Progress(Format format = FORMAT_TEXT, int fd = 2);
+    void SetInterval(double seconds) { m_interval = seconds; }
+    void SetStep(double ratio) { m_step = ratio; }
+    Format GetFormat() const { return m_format; }
+    void Begin(uint64_t totalBytes, uint64_t totalChunks);
+    void Update(uint64_t bytes, uint64_t chunks)
+    {
+        m_bytes = bytes;
+        m_chunks = chunks;
+        if (m_format == FORMAT_NONE)
+            return;
+        double ratio = GetRatio();
+        if (ratio - m_lastRatio >= m_step) {
+            Report("progress");
+            return;
+        }
+        clock::time_point now = clock::now();
+        if (std::chrono::duration<double>(now - m_last).count() >= m_interval)
+            Report("progress", now);
+    }
+    void Finish();
+    void Message(const char *event, const char *text);
+
+    static bool ParseFormat(const char *s, Format *format);
+private:
+    double GetRatio() const
+    {
+        if (m_totalBytes)
+            return std::min(1.0, static_cast<double>(m_bytes) / m_totalBytes);
+        if (m_totalChunks)
+            return static_cast<double>(m_chunks) / m_totalChunks;
+        return 1.0;
+    }
+    void Report(const char *event, clock::time_point now = clock::now());
+    void Emit(const std::string &s);
+};
+
+#endif
@@ -0,0 +1,710 @@
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <climits>
+#include <fstream>
+#include <sstream>
+#include <numeric>
+#include <algorithm>
+#include <list>
+#if defined(_WIN32)
+#include <windows.h>
+#include "utf8_codecvt_facet.hpp"
+#include "strcnv.h"
+#endif
+#include "retime.h"
+#include "indexcache.h"
+
+/*
+ * Finds the fraction with the smallest denominator in [lo, hi] (lo > 0),
+ * going down its continued fraction: x = a + 1 / y, until an integer fits.
+ * Fails when the denominator would exceed maxDenom.
+ */
+bool simplestRational(double lo, double hi, int maxDenom, int *num,
+                      int *denom)
+{
+    int64_t p0 = 0, q0 = 1, p1 = 1, q1 = 0;
+    for (int depth = 0; depth < 64; ++depth) {
+        double a = std::ceil(lo);
+        if (a <= hi) {
+            int64_t p = static_cast<int64_t>(a) * p1 + p0;
+            int64_t q = static_cast<int64_t>(a) * q1 + q0;
+            if (q > maxDenom || p > INT_MAX)
+                return false;
+            *num = static_cast<int>(p);
+            *denom = static_cast<int>(q);
+            return true;
+        }
+        a = std::floor(lo);
+        int64_t p = static_cast<int64_t>(a) * p1 + p0;
+        int64_t q = static_cast<int64_t>(a) * q1 + q0;
+        if (q > maxDenom || p > INT_MAX)
+            return false;
+        p0 = p1;
+        q0 = q1;
+        p1 = p;
+        q1 = q;
+        double l = 1.0 / (hi - a), h = 1.0 / (lo - a);
+        lo = l;
+        hi = h;
+    }
+    return false;
+}
+
+/*
+ * Gives each group of opt.averages an exact rate: the simplest fraction
+ * within the tolerance of its average, either as the rate itself (25, 48,
+ * 25/2) or as an NTSC rate, n * 1000/1001 (30000/1001, 120000/1001).
+ * The smaller denominator wins, and on a tie, the rate closer to the
+ * average. SetFPS() then finds a time scale exact for all of them.
+ *
+ * The errors of the groups add up, so a rate is only taken when the end
+ * of its group stays within the tolerance of the real one; otherwise the
+ * timecodes are used as they are.
+ */
+bool convertToExactRanges(Option &opt)
+{
+    const int MAX_DENOM = 1000;
+    std::vector<FPSRange> ranges;
+    double exactEnd = 0.0, realEnd = 0.0;
+    std::vector<std::pair<size_t, double> >::const_iterator dp;
+    for (dp = opt.averages.begin(); dp != opt.averages.end(); ++dp) {
+        double delta = dp->second;
+        double bound = std::max(1.0 / dp->first, 0.00048828125);
+        if (delta <= bound)
+            return false;
+        double fps = opt.timeScale / delta;
+        double lo = opt.timeScale / (delta + bound);
+        double hi = opt.timeScale / (delta - bound);
+        std::vector<std::pair<int, int> > rates;
+        int num, denom, ntscNum, ntscDenom;
+        if (simplestRational(lo, hi, MAX_DENOM, &num, &denom))
+            rates.push_back(std::make_pair(num, denom));
+        if (simplestRational(lo * 1.001, hi * 1.001, MAX_DENOM,
+                             &ntscNum, &ntscDenom)
+            && ntscDenom == 1 && ntscNum <= INT_MAX / 1000) {
+            std::pair<int, int> ntsc(ntscNum * 1000, 1001);
+            double ntscFps = ntsc.first / 1001.0;
+            if (rates.empty() || denom > 1 || std::abs(ntscFps - fps)
+                    < std::abs(static_cast<double>(num) / denom - fps))
+                rates.insert(rates.begin(), ntsc);
+            else
+                rates.push_back(ntsc);
+        }
+        realEnd += dp->first * delta;
+        double tolerance = dp->first * bound;
+        size_t i;
+        for (i = 0; i < rates.size(); ++i) {
+            double end = exactEnd + static_cast<double>(dp->first)
+                * opt.timeScale * rates[i].second / rates[i].first;
+            if (std::abs(end - realEnd) <= tolerance) {
+                exactEnd = end;
+                break;
+            }
+        }
+        if (i == rates.size())
+            return false;
+        int g = gcd(rates[i].first, rates[i].second);
+        FPSRange range = { static_cast<uint32_t>(dp->first),
+                           rates[i].first / g, rates[i].second / g };
+        ranges.push_back(range);
+    }
+    if (opt.verbose) {
+        std::fprintf(stderr, "Converted to exact fps ranges\n");
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            std::fprintf(stderr, "%d frames: fps %d/%d\n",
+                ranges[i].numFrames, ranges[i].fps_num, ranges[i].fps_denom);
+        }
+    }
+    opt.ranges.swap(ranges);
+    return true;
+}
+
+/*
+ * divide sequence like 1, 2, 1, 1, 2, 3, 2, 3, 3, 2, 1, 1, 2
+ * into groups:
+ * (1, 2, 1, 1, 2), (3, 2, 3, 3, 2), (1, 1, 2)
+ *
+ * each group can hold continuous numbers within [n, n + 1] for some n.
+ */
+template <typename T, typename InputIterator>
+void groupbyAdjacent(InputIterator begin, InputIterator end,
+        std::vector<std::vector<T> > *result)
+{
+    std::vector<std::vector<T> > groups;
+    T low = 1, high = 0;
+    for (; begin != end; ++begin) {
+        if (*begin < low || *begin > high) {
+            groups.push_back(std::vector<T>());
+            low = *begin - 1;
+            high = *begin + 1;
+        } else {
+            T prev = groups.back().back();
+            if (prev != *begin && high - low == 2) {
+                low = std::min(prev, *begin);
+                high = std::max(prev, *begin);
+            }
+        }
+        groups.back().push_back(*begin);
+    }
+    result->swap(groups);
+}
+
+void averageTimecode(Option &opt)
+{
+    std::vector<double> &tc = opt.timecodes;
+    std::vector<int> deltas;
+    int prev = tc[0] + 0.5;
+    for (std::vector<double>::const_iterator ii = ++tc.begin();
+            ii != tc.end(); ++ii) {
+        deltas.push_back(*ii - prev + 0.5);
+        prev = *ii + 0.5;
+    }
+
+    std::vector<std::vector<int> > groups;
+    groupbyAdjacent(deltas.begin(), deltas.end(), &groups);
+
+    for (std::vector<std::vector<int> >::const_iterator kk = groups.begin();
+            kk != groups.end(); ++kk) {
+        uint64_t sum = std::accumulate(kk->begin(), kk->end(), 0ULL);
+        double average = static_cast<double>(sum) / kk->size();
+        opt.averages.push_back(std::make_pair(kk->size(), average));
+    }
+    if (opt.verbose) {
+        std::fprintf(stderr, "Divided into %d group%s\n",
+                int(groups.size()), (groups.size() == 1) ? "" : "s");
+        for (size_t i = 0; i < opt.averages.size(); ++i) {
+            std::fprintf(stderr, "%d frames: time delta %g\n",
+                    int(opt.averages[i].first), opt.averages[i].second);
+        }
+    }
+
+    tc.clear();
+    tc.push_back(0.0);
+    for (size_t i = 0; i < groups.size(); ++i) {
+        for (size_t j = 0; j < groups[i].size(); ++j)
+            tc.push_back(tc.back() + opt.averages[i].second);
+    }
+}
+
+void rescaleTimecode(Option &opt)
+{
+    size_t n = opt.timecodes.size();
+    if (n < 2) return;
+    double delta = opt.timecodes[n-1] - opt.timecodes[n-2];
+    double duration = opt.timecodes[n-1] + delta;
+    double scale = 1;
+
+    if (opt.requestedTimeScale == 0) {
+        double scaleMax = 0x7fffffff / duration;
+        if (scaleMax < 1.0) {
+            while (scale > scaleMax)
+                scale /= 10.0;
+        } else if (opt.timeScale < 100) {
+            scaleMax = std::min(scaleMax, 10000.0 / opt.timeScale);
+            while (scale < scaleMax)
+                scale *= 10.0;
+            scale /= 10.0;
+        }
+    }
+    else if (opt.requestedTimeScale > 0)
+        scale = double(opt.requestedTimeScale) / opt.timeScale;
+    else
+        scale = double(opt.originalTimeScale) / opt.timeScale;
+
+    for (size_t i = 0; i < n; ++i)
+       opt.timecodes[i] *= scale;
+    opt.timeScale *= scale;
+}
+
+/*
+ * Replaces opt.timecodes, in ticks of opt.timeScale, by runs of a constant
+ * whole delta, so that no frame moves by more than opt.maxDeviation ms.
+ *
+ * Each run goes on as long as some delta d keeps every frame in bounds:
+ * a run starting at frame s at time v can take frame i with
+ *   (t[i] - bound - v) / (i - s) <= d <= (t[i] + bound - v) / (i - s),
+ * so the deltas left are an interval, narrowed in O(1) per frame. Of
+ * those, the one ending the run closest to its last timecode is taken.
+ */
+void segmentTimecode(Option &opt)
+{
+    std::vector<double> &tc = opt.timecodes;
+    size_t n = tc.size();
+    if (n < 2) return;
+    double bound = opt.maxDeviation * opt.timeScale / 1000.0;
+    if (bound < 0.5)
+        throw std::runtime_error("--max-deviation is less than half a tick "
+                                 "of the time scale");
+
+    size_t before = 0;
+    int64_t prev = -1;
+    for (size_t i = 1; i < n; ++i) {
+        int64_t delta = static_cast<int64_t>(tc[i] + 0.5)
+                      - static_cast<int64_t>(tc[i - 1] + 0.5);
+        if (delta != prev)
+            ++before;
+        prev = delta;
+    }
+
+    std::vector<double> result(n);
+    result[0] = std::floor(tc[0] + 0.5);
+    double maxError = std::abs(result[0] - tc[0]);
+    size_t after = 0;
+    double prevDelta = -1;
+    for (size_t s = 0; s < n - 1; ) {
+        double v = result[s], lo = 1.0, hi = HUGE_VAL;
+        size_t e = s;
+        for (size_t i = s + 1; i < n; ++i) {
+            double k = static_cast<double>(i - s);
+            double l = std::max(lo, (tc[i] - bound - v) / k);
+            double h = std::min(hi, (tc[i] + bound - v) / k);
+            if (std::ceil(l) > std::floor(h))
+                break;
+            lo = l;
+            hi = h;
+            e = i;
+        }
+        if (e == s) {
+            std::stringstream msg;
+            msg << "Frames " << s << " and " << s + 1 << " are too close "
+                   "to stay within --max-deviation at time scale "
+                << opt.timeScale;
+            throw std::runtime_error(msg.str());
+        }
+        double d = std::floor((tc[e] - v) / (e - s) + 0.5);
+        d = std::min(std::max(d, std::ceil(lo)), std::floor(hi));
+        for (size_t i = s + 1; i <= e; ++i) {
+            result[i] = v + (i - s) * d;
+            maxError = std::max(maxError, std::abs(result[i] - tc[i]));
+        }
+        if (d != prevDelta)
+            ++after;
+        prevDelta = d;
+        s = e;
+    }
+    if (opt.verbose) {
+        std::fprintf(stderr, "stts: %d entries -> %d, "
+                "max deviation %.3f ms\n", int(before), int(after),
+                maxError * 1000.0 / opt.timeScale);
+    }
+    tc.swap(result);
+}
+
+void parseTimecodeV2(Option &opt, std::istream &is, size_t count)
+{
+    std::string line;
+    bool is_float = false;
+    size_t nline = 0;
+    while (opt.timecodes.size() < count && std::getline(is, line)) {
+        ++nline;
+        if (line.size() && line[0] == '#')
+            continue;
+        double stamp;
+        if (std::strchr(line.c_str(), '.')) is_float = true;
+        if (std::sscanf(line.c_str(), "%lf", &stamp) == 1) {
+            if (opt.timecodes.size() && stamp <= opt.timecodes.back()) {
+                std::stringstream msg;
+                msg << "Timecode is not monotone increasing! at line " << nline;
+                throw std::runtime_error(msg.str());
+            }
+            opt.timecodes.push_back(stamp);
+        }
+    }
+    finishTimecodes(opt, count);
+}
+
+void finishTimecodes(Option &opt, size_t count)
+{
+    if (!opt.timecodes.size())
+        throw std::runtime_error("No entry in the timecode file");
+    if (opt.timecodes.size() > count)
+        opt.timecodes.resize(count);
+    if (opt.timecodes.size() == count -1 && opt.timecodes.size() >= 2) {
+        double last = opt.timecodes[opt.timecodes.size()-1];
+        double prev = opt.timecodes[opt.timecodes.size()-2];
+        opt.timecodes.push_back(last * 2 - prev);
+    }
+    if (opt.optimizeTimecode)
+        averageTimecode(opt);
+}
+
+#ifdef _WIN32
+void loadTimecodeV2(Option &option, size_t count)
+{
+    std::wstring wfname = m2w(option.timecodeFile, utf8_codecvt_facet());
+
+    HANDLE fh = CreateFileW(wfname.c_str(), GENERIC_READ,
+        FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+    if (fh == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Can't open timecode file");
+
+    DWORD nread;
+    char buffer[8192];
+    std::stringstream ss;
+    while (ReadFile(fh, buffer, sizeof buffer, &nread, 0) && nread > 0)
+        ss.write(buffer, nread);
+    CloseHandle(fh);
+
+    ss.seekg(0);
+    parseTimecodeV2(option, ss, count);
+}
+#else
+void loadTimecodeV2(Option &option, size_t count)
+{
+    std::ifstream ifs(option.timecodeFile);
+    if (!ifs)
+        throw std::runtime_error("Can't open timecode file");
+    parseTimecodeV2(option, ifs, count);
+}
+#endif
+
+void printTimeCodes(const Option &opt, TrackEditor &track)
+{
+#ifdef _WIN32
+    utf8_codecvt_facet u8codec;
+    std::wstring wname = m2w(opt.timecodeFile, utf8_codecvt_facet());
+    FILE *fp = std::strcmp(opt.timecodeFile, "-")
+               ? _wfopen(wname.c_str(), L"w")
+               : stdout;
+#else
+    FILE *fp = std::strcmp(opt.timecodeFile, "-")
+               ? std::fopen(opt.timecodeFile, "w")
+               : stdout;
+#endif
+    if (!fp)
+        throw std::runtime_error("Can't open timecode file");
+    uint32_t timeScale = track.GetTimeScale();
+    std::fputs("# timecode format v2\n", fp);
+    if (track.GetFrameCount()) {
+        uint64_t off = track.CTS(0);
+        for (size_t i = 0; i < track.GetFrameCount(); ++i) {
+            uint64_t cts = track.CTS(i) - off;
+            std::fprintf(fp, "%.15g\n",
+                static_cast<double>(cts) / timeScale * 1000.0);
+        }
+    }
+    std::fclose(fp);
+}
+
+std::list<double> fixAudioTimeCodes(Option& opt, mp4v2::impl::MP4File &file, TrackEditor &vtrackeditor)
+{
+    MP4TrackId atrackId = file.FindTrackId(0, MP4_AUDIO_TRACK_TYPE);
+    MP4TrackX* atrack = reinterpret_cast<MP4TrackX*>(file.GetTrack(atrackId));
+    double timescale = atrack->GetTimeScale();
+    TrackEditor aeditor(reinterpret_cast<MP4TrackX*>(atrack));
+    size_t cnt = aeditor.GetFrameCount();
+    std::list<double> vctsList, fixedVctsList;
+    for (size_t i = 0; i < vtrackeditor.GetFrameCount() + 1; ++i)
+        vctsList.push_back(vtrackeditor.CTS(i));
+
+    int64_t dts_diff = 0;
+    const double alpha = 0.2;
+    double timeDelta = 0;
+    for (size_t i = 1; i <= cnt; ++i) {
+        double dts = aeditor.DTS(i);
+        double fixed = opt.audioTimeDelta * i;
+        while (vctsList.size()) {
+            double vcts = vctsList.front();
+            if (vcts * aeditor.GetTimeScale() / vtrackeditor.GetTimeScale() > dts) break;
+            double newvcts = vcts * fixed / dts;
+            if (!fixedVctsList.size()) {
+                fixedVctsList.push_back(newvcts);
+            } else if (timeDelta == 0) {
+                timeDelta = newvcts - fixedVctsList.back();
+                fixedVctsList.push_back(newvcts);
+            } else  {
+                double lastCts = fixedVctsList.back();
+                timeDelta = alpha * (newvcts - lastCts) + (1.0 - alpha) * timeDelta;
+                fixedVctsList.push_back(lastCts + timeDelta);
+            }
+            dts_diff = newvcts - vcts;
+            vctsList.pop_front();
+        }
+    }
+    while (vctsList.size()) {
+        double vcts = vctsList.front();
+        fixedVctsList.push_back(vcts + dts_diff);
+        vctsList.pop_front();
+    }
+
+    int nstts = atrack->SttsCountProperty()->GetValue();
+    atrack->SttsCountProperty()->IncrementValue(-1 * nstts);
+    atrack->SttsSampleCountProperty()->SetCount(0);
+    atrack->SttsSampleDeltaProperty()->SetCount(0);
+    atrack->SttsCountProperty()->IncrementValue();
+    atrack->SttsSampleCountProperty()->AddValue(cnt);
+    atrack->SttsSampleDeltaProperty()->AddValue(opt.audioTimeDelta);
+    atrack->InvalidateSampleTimesX();
+    atrack->MediaDurationProperty()->SetValue(0);
+    atrack->UpdateDurationsX(cnt * opt.audioTimeDelta);
+
+    return fixedVctsList;
+}
+
+namespace {
+
+/* what an edit has to rewrite, as far as the options tell */
+enum EditScope {
+    EDIT_NOTHING,
+    EDIT_EDIT_LISTS,    // -d alone: the sample times stay as they are
+    EDIT_FRAME_RATE,    // -r: new times may follow from the ranges alone
+    EDIT_SAMPLES
+};
+
+EditScope planEdit(const Option &opt, MP4TrackX *track)
+{
+    if (opt.printOnly)
+        return EDIT_SAMPLES;
+    if (opt.ranges.size() && !opt.compressDTS)
+        return EDIT_FRAME_RATE;
+    if (opt.timecodeFile || opt.ranges.size()
+        || opt.timecodes.size() || opt.optimizeTimecode || opt.compressDTS
+        || opt.requestedTimeScale > 0 || opt.audioTimeDelta > 0
+        || opt.maxDeviation > 0)
+        return EDIT_SAMPLES;
+    if (!opt.audioDelay)
+        return EDIT_NOTHING;
+    /*
+     * Unless kept with -T, the time scale of a rebuilt table is raised when
+     * below 100, and lowered when the duration would not fit in 31 bits.
+     */
+    if (opt.requestedTimeScale == 0
+        && (track->GetTimeScale() < 100
+            || track->MediaDurationProperty()->GetValue() >= 0x7fffffff / 2))
+        return EDIT_SAMPLES;
+    return EDIT_EDIT_LISTS;
+}
+
+}
+
+bool editFile(Option &opt, mp4v2::impl::MP4File &file,
+              IndexCache *index, uint32_t cachedTrack, SampleTable *cached)
+{
+    MP4TrackId trackId = file.FindTrackId(0, MP4_VIDEO_TRACK_TYPE);
+    mp4v2::impl::MP4Track *track = file.GetTrack(trackId);
+    // XXX
+    MP4TrackX *trackx = reinterpret_cast<MP4TrackX*>(track);
+    if (cached && cachedTrack != trackId)
+        cached = 0;
+    /*
+     * Without a table to save, edits that leave the sample times alone
+     * don't need the samples decoded, nor do most frame rate changes.
+     */
+    EditScope scope = planEdit(opt, trackx);
+    if (scope != EDIT_SAMPLES && !(index && !cached)) {
+        opt.originalTimeScale = trackx->GetTimeScale();
+        if (scope == EDIT_EDIT_LISTS)
+            TrackEditor::DelayByEditLists(trackx, opt.audioDelay);
+        if (scope != EDIT_FRAME_RATE)
+            return true;
+        SampleTable empty;
+        empty.timeScale = opt.originalTimeScale;
+        TrackEditor editor(trackx, &empty);
+        editor.SetAudioDelay(opt.audioDelay);
+        if (editor.SetFPSFromRuns(&opt.ranges[0], opt.ranges.size(),
+                                  opt.requestedTimeScale))
+            return true;
+    }
+    TrackEditor editor = cached ? TrackEditor(trackx, cached)
+                                : TrackEditor(trackx);
+    if (index && !cached) {
+        SampleTable table;
+        editor.SaveTable(&table);
+        mp4v2::impl::MP4Atom *moov = file.FindAtom("moov");
+        if (!index->Save(trackId, table, moov->GetStart(), moov->GetSize()))
+            std::fprintf(stderr, "Cannot write index cache %s\n",
+                         opt.indexFile);
+    }
+    opt.originalTimeScale = editor.GetTimeScale();
+    if (opt.printOnly) {
+        printTimeCodes(opt, editor);
+        return false;
+    }
+    editor.SetAudioDelay(opt.audioDelay);
+    if (opt.compressDTS)
+        editor.EnableDTSCompression(true);
+    if (opt.ranges.size())
+        editor.SetFPS(&opt.ranges[0], opt.ranges.size(),
+                      opt.requestedTimeScale);
+    else if (opt.timecodeFile || opt.modified()) {
+        if (opt.timecodeFile)
+            loadTimecodeV2(opt, editor.GetFrameCount() + 1);
+        else if (opt.timecodes.size())
+            finishTimecodes(opt, editor.GetFrameCount() + 1);
+        else if (opt.audioTimeDelta > 0) {
+            std::list<double> vctsList = fixAudioTimeCodes(opt, file, editor);
+            opt.timeScale = opt.originalTimeScale;
+            for (auto it = vctsList.begin(); it != vctsList.end(); ++it) {
+                opt.timecodes.push_back(*it);
+            }
+            if (opt.optimizeTimecode)
+                averageTimecode(opt);
+        }
+        else {
+            uint64_t off = editor.CTS(0);
+            opt.timeScale = opt.originalTimeScale;
+            for (size_t i = 0; i < editor.GetFrameCount() + 1; ++i)
+                opt.timecodes.push_back(editor.CTS(i) - off);
+            if (opt.optimizeTimecode)
+                averageTimecode(opt);
+        }
+        if (opt.optimizeTimecode && convertToExactRanges(opt))
+            editor.SetFPS(&opt.ranges[0], opt.ranges.size(),
+                          opt.requestedTimeScale);
+        else {
+            rescaleTimecode(opt);
+            if (opt.maxDeviation > 0)
+                segmentTimecode(opt);
+            editor.SetTimeCodes(&opt.timecodes[0],
+                    opt.timecodes.size(),
+                    opt.timeScale);
+        }
+    }
+    if (opt.modified()) {
+        editor.AdjustTimeCodes();
+        editor.DoEditTimeCodes();
+    }
+    return true;
+}
+
+namespace {
+
+mp4v2::impl::MP4IntegerProperty *trakProperty(MP4TrackX *track,
+                                              const char *name)
+{
+    mp4v2::impl::MP4Property *prop;
+    std::string path = std::string("trak.") + name;
+    if (!track->GetTrakAtom().FindProperty(path.c_str(), &prop))
+        return 0;
+    return dynamic_cast<mp4v2::impl::MP4IntegerProperty*>(prop);
+}
+
+void saveRuns(mp4v2::impl::MP4Integer32Property *count,
+              mp4v2::impl::MP4Integer32Property *sampleCount,
+              mp4v2::impl::MP4Integer32Property *value,
+              std::vector<std::pair<uint32_t, uint32_t> > *runs)
+{
+    uint32_t n = count->GetValue();
+    for (uint32_t j = 0; j < n; ++j)
+        runs->push_back(std::make_pair(sampleCount->GetValue(j),
+                                       value->GetValue(j)));
+}
+
+void restoreRuns(mp4v2::impl::MP4Integer32Property *count,
+                 mp4v2::impl::MP4Integer32Property *sampleCount,
+                 mp4v2::impl::MP4Integer32Property *value,
+                 const std::vector<std::pair<uint32_t, uint32_t> > &runs)
+{
+    count->IncrementValue(-1 * static_cast<int32_t>(count->GetValue()));
+    sampleCount->SetCount(0);
+    value->SetCount(0);
+    for (size_t j = 0; j < runs.size(); ++j) {
+        count->IncrementValue();
+        sampleCount->AddValue(runs[j].first);
+        value->AddValue(runs[j].second);
+    }
+}
+
+}
+
+EditCheckpoint::EditCheckpoint(mp4v2::impl::MP4File &file)
+    : m_file(file), m_duration(file.GetDuration())
+{
+    uint32_t ntracks = file.GetNumberOfTracks();
+    for (uint32_t i = 0; i < ntracks; ++i) {
+        TrackState state;
+        state.track = reinterpret_cast<MP4TrackX*>(
+            file.GetTrack(file.FindTrackId(i)));
+        MP4TrackX *track = state.track;
+        state.timeScale = track->GetTimeScale();
+        state.mediaDuration = track->MediaDurationProperty()->GetValue();
+        state.trackDuration = track->TrackDurationProperty()->GetValue();
+        mp4v2::impl::MP4IntegerProperty *prop =
+            trakProperty(track, "mdia.mdhd.creationTime");
+        state.creationTime = prop ? prop->GetValue() : 0;
+        state.modificationTime =
+            track->MediaModificationProperty()->GetValue();
+        state.trackModificationTime =
+            track->TrackModificationProperty()->GetValue();
+        state.mdhdFlags =
+            track->GetTrakAtom().FindAtom("trak.mdia.mdhd")->GetFlags();
+        uint32_t numEdits = track->ElstCountProperty()
+            ? track->ElstCountProperty()->GetValue() : 0;
+        for (uint32_t j = 0; j < numEdits; ++j) {
+            Edit edit;
+            edit.mediaTime = track->ElstMediaTimeProperty()->GetValue(j);
+            edit.duration = track->ElstDurationProperty()->GetValue(j);
+            edit.rate = track->ElstRateProperty()->GetValue(j);
+            state.edits.push_back(edit);
+        }
+        /* where edts goes back to, as edits re-add it at the end of trak */
+        mp4v2::impl::MP4Atom &trak = track->GetTrakAtom();
+        state.edtsIndex = 0;
+        while (state.edtsIndex < trak.GetNumberOfChildAtoms()
+                && std::strcmp(trak.GetChildAtom(state.edtsIndex)->GetType(),
+                               "edts"))
+            ++state.edtsIndex;
+        bool video = !std::strcmp(track->GetType(), MP4_VIDEO_TRACK_TYPE);
+        if (video || !std::strcmp(track->GetType(), MP4_AUDIO_TRACK_TYPE))
+            saveRuns(track->SttsCountProperty(),
+                     track->SttsSampleCountProperty(),
+                     track->SttsSampleDeltaProperty(), &state.stts);
+        if (video && track->CttsCountProperty())
+            saveRuns(track->CttsCountProperty(),
+                     track->CttsSampleCountProperty(),
+                     track->CttsSampleOffsetProperty(), &state.ctts);
+        m_tracks.push_back(state);
+    }
+}
+
+void EditCheckpoint::Restore()
+{
+    m_file.SetDuration(m_duration);
+    for (size_t i = 0; i < m_tracks.size(); ++i) {
+        const TrackState &state = m_tracks[i];
+        MP4TrackX *track = state.track;
+        /* mdhd is a new atom once the time scale or duration changed */
+        track->TimeScaleProperty()->SetValue(state.timeScale);
+        track->MediaDurationProperty()->SetValue(state.mediaDuration);
+        track->TrackDurationProperty()->SetValue(state.trackDuration);
+        mp4v2::impl::MP4IntegerProperty *prop =
+            trakProperty(track, "mdia.mdhd.creationTime");
+        if (prop)
+            prop->SetValue(state.creationTime);
+        track->MediaModificationProperty()->SetValue(state.modificationTime);
+        track->TrackModificationProperty()->SetValue(
+            state.trackModificationTime);
+        track->GetTrakAtom().FindAtom("trak.mdia.mdhd")->SetFlags(
+            state.mdhdFlags);
+        if (track->ElstCountProperty()) {
+            for (uint32_t j = track->ElstCountProperty()->GetValue(); j > 0;
+                 --j)
+                track->DeleteEdit(j);
+        }
+        for (size_t j = 0; j < state.edits.size(); ++j) {
+            track->AddEdit();
+            track->ElstMediaTimeProperty()->SetValue(state.edits[j].mediaTime,
+                                                     j);
+            track->ElstDurationProperty()->SetValue(state.edits[j].duration,
+                                                    j);
+            track->ElstRateProperty()->SetValue(state.edits[j].rate, j);
+        }
+        if (state.edits.size()) {
+            mp4v2::impl::MP4Atom &trak = track->GetTrakAtom();
+            mp4v2::impl::MP4Atom *edts = trak.FindAtom("trak.edts");
+            trak.DeleteChildAtom(edts);
+            trak.InsertChildAtom(edts, state.edtsIndex);
+        }
+        bool video = !std::strcmp(track->GetType(), MP4_VIDEO_TRACK_TYPE);
+        if (video || !std::strcmp(track->GetType(), MP4_AUDIO_TRACK_TYPE))
+            restoreRuns(track->SttsCountProperty(),
+                        track->SttsSampleCountProperty(),
+                        track->SttsSampleDeltaProperty(), state.stts);
+        if (video && track->CttsCountProperty())
+            restoreRuns(track->CttsCountProperty(),
+                        track->CttsSampleCountProperty(),
+                        track->CttsSampleOffsetProperty(), state.ctts);
+        track->InvalidateSampleTimesX();
+    }
+}
@@ -0,0 +1,153 @@
+#ifndef RETIME_H
+#define RETIME_H
+
+#include <vector>
+#include <utility>
+#include "mp4trackx.h"
+#include "progress.h"
+
+class IndexCache;
+
+struct Option {
+    const char *src, *dst, *timecodeFile, *journalFile, *indexFile;
+    const char *servePath;
+    bool inplace;
+    bool compressDTS;
+    bool optimizeTimecode;
+    bool printOnly;
+    bool inMemory;
+    bool directIO;
+    uint32_t originalTimeScale;
+    uint32_t timeScale;
+    int requestedTimeScale;
+    int audioDelay;
+    int audioTimeDelta;
+    double maxDeviation;    // ms, for runs of a constant delta; 0: off
+    Progress::Format progressFormat;
+    int progressFd;
+    unsigned threads;
+    unsigned copyThreads;
+    unsigned jobs;
+    bool verbose;
+    /*
+     * When set, input is read / output is written through these
+     * callbacks instead of src / dst paths (see memoryio.h).
+     */
+    const MP4IOCallbacks *srcCallbacks;
+    void *srcHandle;
+    const MP4IOCallbacks *dstCallbacks;
+    void *dstHandle;
+    std::vector<FPSRange> ranges;
+    std::vector<double> timecodes;
+    std::vector<std::pair<size_t, double> > averages;
+    /* one per output of --and, with the edits that apply to it */
+    std::vector<Option> variants;
+
+    Option()
+    {
+        src = 0;
+        dst = 0;
+        timecodeFile = 0;
+        journalFile = 0;
+        indexFile = 0;
+        servePath = 0;
+        inplace = false;
+        compressDTS = false;
+        optimizeTimecode = false;
+        printOnly = false;
+        inMemory = false;
+        directIO = false;
+        requestedTimeScale = 0;
+        timeScale = 1000;
+        audioDelay = 0;
+        audioTimeDelta = 0;
+        maxDeviation = 0.0;
+        progressFormat = Progress::FORMAT_TEXT;
+        progressFd = 2;
+        threads = 1;
+        copyThreads = 1;
+        jobs = 0;
+        verbose = true;
+        srcCallbacks = 0;
+        srcHandle = 0;
+        dstCallbacks = 0;
+        dstHandle = 0;
+    }
+    bool modified() {
+        return compressDTS || audioDelay || ranges.size()
+            || timecodes.size() || optimizeTimecode || requestedTimeScale > 0 || audioTimeDelta > 0
+            || maxDeviation > 0;
+    }
+    /*
+     * takes the output and the edits of from
+     * (-o, -t, -x, -r, -c, -d, -T, -A, --max-deviation)
+     */
+    void setEdits(const Option &from)
+    {
+        dst = from.dst;
+        timecodeFile = from.timecodeFile;
+        optimizeTimecode = from.optimizeTimecode;
+        ranges = from.ranges;
+        compressDTS = from.compressDTS;
+        audioDelay = from.audioDelay;
+        requestedTimeScale = from.requestedTimeScale;
+        audioTimeDelta = from.audioTimeDelta;
+        maxDeviation = from.maxDeviation;
+    }
+};
+
+/*
+ * Applies the requested edits to the parsed file.
+ * Returns false when there is nothing to write (print only).
+ *
+ * With an index cache, the sample table of the video track is taken from
+ * cached (track cachedTrack) when given, or else saved to the cache.
+ */
+bool editFile(Option &opt, mp4v2::impl::MP4File &file,
+              IndexCache *index = 0, uint32_t cachedTrack = 0,
+              SampleTable *cached = 0);
+
+/*
+ * Checks opt.timecodes (milliseconds, as read from a timecode-v2 file)
+ * against the count of frames + 1, and completes them.
+ */
+void finishTimecodes(Option &opt, size_t count);
+
+void printTimeCodes(const Option &opt, TrackEditor &track);
+
+/*
+ * Keeps what editFile() changes in a file: time scales and durations,
+ * mdhd (which it may replace) and the tkhd times, edit lists, the stts of
+ * audio and video tracks and the ctts of video tracks (which edits that
+ * skip decoding read back). Restore() puts them back, so that one parsed
+ * file can be edited once per variant of --and, in any order.
+ */
+class EditCheckpoint {
+    struct Edit {
+        uint64_t mediaTime;
+        uint64_t duration;
+        uint16_t rate;
+    };
+    struct TrackState {
+        MP4TrackX *track;
+        uint32_t timeScale;
+        uint64_t mediaDuration;
+        uint64_t trackDuration;
+        uint64_t creationTime;
+        uint64_t modificationTime;
+        uint64_t trackModificationTime;
+        uint32_t mdhdFlags;
+        uint32_t edtsIndex;
+        std::vector<Edit> edits;
+        std::vector<std::pair<uint32_t, uint32_t> > stts;
+        std::vector<std::pair<uint32_t, uint32_t> > ctts;
+    };
+    mp4v2::impl::MP4File &m_file;
+    MP4Duration m_duration;
+    std::vector<TrackState> m_tracks;
+public:
+    explicit EditCheckpoint(mp4v2::impl::MP4File &file);
+    void Restore();
+};
+
+#endif
@@ -0,0 +1,145 @@
+#if !defined(_WIN32)
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "server.h"
+
+JobServer::JobServer(const char *path, unsigned threads, Handler handler)
+    : m_path(path), m_threads(threads ? threads : 1), m_handler(handler),
+      m_socket(-1)
+{
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (m_path.size() >= sizeof addr.sun_path)
+        throw std::runtime_error("socket path too long: " + m_path);
+    std::strcpy(addr.sun_path, m_path.c_str());
+
+    /* a socket left behind by a server that is gone can be replaced */
+    struct stat st;
+    if (stat(m_path.c_str(), &st) == 0) {
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool alive = probe >= 0 && S_ISSOCK(st.st_mode)
+            && connect(probe, (struct sockaddr *)&addr, sizeof addr) == 0;
+        if (probe >= 0)
+            close(probe);
+        if (alive || !S_ISSOCK(st.st_mode))
+            throw std::runtime_error(m_path + " is in use");
+        unlink(m_path.c_str());
+    }
+
+    /* jobs run with our rights: only our own user may connect */
+    m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t mask = umask(0077);
+    int bound = m_socket < 0
+        ? -1 : bind(m_socket, (struct sockaddr *)&addr, sizeof addr);
+    int error = errno;
+    umask(mask);
+    errno = error;
+    if (bound < 0 || listen(m_socket, 128) < 0) {
+        std::string msg = std::strerror(errno);
+        if (m_socket >= 0)
+            close(m_socket);
+        throw std::runtime_error("cannot listen on " + m_path + ": " + msg);
+    }
+}
+
+JobServer::~JobServer()
+{
+    close(m_socket);
+    unlink(m_path.c_str());
+}
+
+void JobServer::Run()
+{
+    /* a client that hangs up must not take the server down */
+    signal(SIGPIPE, SIG_IGN);
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < m_threads; ++i)
+        workers.push_back(std::thread([this]() { serve(); }));
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+}
+
+void JobServer::serve()
+{
+    for (;;) {
+        int fd = accept(m_socket, 0, 0);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            std::fprintf(stderr, "accept: %s\n", std::strerror(errno));
+            return;
+        }
+        std::vector<std::string> args;
+        if (readRequest(fd, &args)) {
+            try {
+                m_handler(args, fd);
+            } catch (const std::exception &e) {
+                std::fprintf(stderr, "%s\n", e.what());
+            }
+        }
+        close(fd);
+    }
+}
+
+/* false if the client went away or sent too much */
+bool JobServer::readRequest(int fd, std::vector<std::string> *args)
+{
+    std::string request;
+    for (;;) {
+        size_t end = request.find("\n\n");
+        if (end != std::string::npos) {
+            request.resize(end + 1);
+            break;
+        }
+        if (!request.empty() && request[0] == '\n') {
+            request.clear();
+            break;
+        }
+        if (request.size() > MAX_REQUEST)
+            return false;
+        char buffer[4096];
+        ssize_t n = read(fd, buffer, sizeof buffer);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        for (ssize_t i = 0; i < n; ++i)
+            if (buffer[i] != '\r')
+                request += buffer[i];
+    }
+    for (size_t pos = 0, nl; (nl = request.find('\n', pos)) != std::string::npos;
+         pos = nl + 1) {
+        if (nl > pos)
+            args->push_back(request.substr(pos, nl - pos));
+    }
+    return true;
+}
+
+#else
+#include <stdexcept>
+#include "server.h"
+
+JobServer::JobServer(const char *, unsigned, Handler)
+    : m_threads(0), m_socket(-1)
+{
+    throw std::runtime_error("--serve is not supported on this platform");
+}
+
+JobServer::~JobServer()
+{
+}
+
+void JobServer::Run()
+{
+}
+#endif
@@ -0,0 +1,44 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+#include <vector>
+#include <functional>
+
+/*
+ * Job server of --serve, listening on a Unix-domain socket.
+ *
+ * A client connects, sends a command line (without the program name) one
+ * argument per line, ends it with an empty line, and reads the replies of
+ * the handler until the server closes the connection.
+ *
+ * A fixed pool of threads accepts the connections and runs one job each
+ * at a time, so that the number of jobs in flight, and the memory they
+ * take, is capped by the pool size; further clients wait in the listen
+ * backlog.
+ */
+class JobServer {
+public:
+    typedef std::function<void(const std::vector<std::string> &args,
+                               int fd)> Handler;
+private:
+    enum { MAX_REQUEST = 64 * 1024 };
+
+    std::string m_path;
+    unsigned m_threads;
+    Handler m_handler;
+    int m_socket;
+public:
+    JobServer(const char *path, unsigned threads, Handler handler);
+    ~JobServer();
+    /* serves until the process is terminated */
+    void Run();
+private:
+    void serve();
+    bool readRequest(int fd, std::vector<std::string> *args);
+
+    JobServer(const JobServer &);
+    JobServer &operator=(const JobServer &);
+};
+
+#endif